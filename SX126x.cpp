@@ -1,187 +1,923 @@
 #include "SX126x.h"
 
-SX126x* SX126x::module1_ptr = nullptr;
-SX126x* SX126x::module2_ptr = nullptr;
+SX126x* SX126x::Instances[SX126X_MAX_INSTANCES] = { nullptr };
+
+// Configuration commands whose parameters completely define a piece of chip state. Sending one of them again with the
+// parameters it was last sent with does not change anything, so SPIwriteCommand() skips it. The order is the order
+// RestoreShadow() replays them in after a cold sleep: oscillator and regulator setup come first, the chip is
+// calibrated after SX126X_SHADOW_CALIBRATE_AFTER entries, then the modem and PA setup follows.
+#define SX126X_SHADOW_CALIBRATE_AFTER   3
+static const uint8_t SX126X_SHADOWED_COMMANDS[SX126X_SHADOW_SLOTS] = {
+  SX126X_CMD_SET_DIO3_AS_TCXO_CTRL,
+  SX126X_CMD_SET_REGULATOR_MODE,
+  SX126X_CMD_SET_DIO2_AS_RF_SWITCH_CTRL,
+  SX126X_CMD_SET_PACKET_TYPE,
+  SX126X_CMD_SET_MODULATION_PARAMS,
+  SX126X_CMD_SET_PACKET_PARAMS,
+  SX126X_CMD_SET_CAD_PARAMS,
+  SX126X_CMD_CALIBRATE_IMAGE,
+  SX126X_CMD_SET_RF_FREQUENCY,
+  SX126X_CMD_SET_PA_CONFIG,
+  SX126X_CMD_SET_TX_PARAMS,
+  SX126X_CMD_WRITE_REGISTER,
+  SX126X_CMD_SET_DIO_IRQ_PARAMS,
+  SX126X_CMD_SET_BUFFER_BASE_ADDRESS,
+  SX126X_CMD_SET_LORA_SYMB_NUM_TIMEOUT,
+  SX126X_CMD_STOP_TIMER_ON_PREAMBLE
+};
+
+
+// Steps of the configuration sequence run by RunSequence(). ModuleConfig() starts at SX126X_SEQ_RESET and ends after
+// SX126X_SEQ_FREQUENCY, LoRaBegin() runs from SX126X_SEQ_LORA to the end. The commands of one step only keep BUSY high
+// for a few us, except for the last one.
+#define SX126X_SEQ_IDLE                 0
+#define SX126X_SEQ_RESET                1
+#define SX126X_SEQ_RESET_RELEASE        2
+#define SX126X_SEQ_STANDBY              3
+#define SX126X_SEQ_CHECK_MODE           4
+#define SX126X_SEQ_TCXO                 5
+#define SX126X_SEQ_CALIBRATE            6
+#define SX126X_SEQ_CHECK_CALIBRATION    7
+#define SX126X_SEQ_CALIBRATE_IMAGE      8
+#define SX126X_SEQ_FREQUENCY            9
+#define SX126X_SEQ_LORA                 10
+#define SX126X_SEQ_LORA_MODEM           11
+#define SX126X_SEQ_LORA_DEFAULT_MODE    12
+
+// States of a link adaptation rate switch, see LinkAdaptBegin()
+#define SX126X_LINK_STATE_IDLE          0
+#define SX126X_LINK_STATE_SWITCH_SENT   1   // we asked, waiting for SWITCH_ACK
+#define SX126X_LINK_STATE_SWITCH_ACKED  2   // the peer asked, we switch once our SWITCH_ACK is out
+#define SX126X_LINK_STATE_WAIT_CONFIRM  3   // switched, waiting for the peer's CONFIRM on the new rate
+#define SX126X_LINK_NONE                0xFF
+
+
+// valid SX126X_GFSK_RX_BW_* codes
+static const uint8_t SX126X_GFSK_RX_BANDWIDTHS[] = {
+  SX126X_GFSK_RX_BW_4_8,   SX126X_GFSK_RX_BW_5_8,   SX126X_GFSK_RX_BW_7_3,   SX126X_GFSK_RX_BW_9_7,   SX126X_GFSK_RX_BW_11_7,
+  SX126X_GFSK_RX_BW_14_6,  SX126X_GFSK_RX_BW_19_5,  SX126X_GFSK_RX_BW_23_4,  SX126X_GFSK_RX_BW_29_3,  SX126X_GFSK_RX_BW_39_0,
+  SX126X_GFSK_RX_BW_46_9,  SX126X_GFSK_RX_BW_58_6,  SX126X_GFSK_RX_BW_78_2,  SX126X_GFSK_RX_BW_93_8,  SX126X_GFSK_RX_BW_117_3,
+  SX126X_GFSK_RX_BW_156_2, SX126X_GFSK_RX_BW_187_2, SX126X_GFSK_RX_BW_234_3, SX126X_GFSK_RX_BW_312_0, SX126X_GFSK_RX_BW_373_6,
+  SX126X_GFSK_RX_BW_467_0
+};
+
+static bool IsGfskRxBandwidth(uint8_t rxBandwidth)
+{
+  for ( uint8_t i = 0; i < sizeof(SX126X_GFSK_RX_BANDWIDTHS); i++ ) {
+    if ( SX126X_GFSK_RX_BANDWIDTHS[i] == rxBandwidth ) {
+      return true;
+    }
+  }
+  return false;
+}
 
-void SX126x::DIO1_ISR_1(void) 
+
+// goes on air in front of an application frame that starts like one of the driver's own frames
+static const uint8_t SX126X_ESCAPE_HEADER[1] = { SX126X_ESCAPE_MARKER };
+
+// 1 if the application frame starts with a reserved byte and needs SX126X_ESCAPE_HEADER, otherwise 0
+static uint8_t EscapeLength(const uint8_t *pData, uint16_t len)
 {
-  module1_ptr->Dio1Interrupt();
+  return ( len > 0 && pData[0] >= SX126X_RESERVED_FIRST && pData[0] <= SX126X_RESERVED_LAST ) ? 1 : 0;
 }
 
-void SX126x::DIO1_ISR_2(void) 
+
+#ifdef ARDUINO
+SX126x::SX126x(int spiSelect, int reset, int busy, int interrupt)
+  : ArduinoHal(spiSelect, reset, busy, interrupt)
 {
-  module2_ptr->Dio1Interrupt();
+  Hal = &ArduinoHal;
+  InitMembers();
 }
+#endif
 
 
-SPISettings SX126x::SX126X_SPI_SETTINGS(8000000, MSBFIRST, SPI_MODE0);
+SX126x::SX126x(SX126xHal* hal)
+#ifdef ARDUINO
+  : ArduinoHal(-1, -1, -1, -1)
+#endif
+{
+  Hal = hal;
+  InitMembers();
+}
 
-SX126x::SX126x(int spiSelect, int reset, int busy, int interrupt)
+
+// state shared by both constructors, Hal must already be set
+void SX126x::InitMembers(void)
 {
-  SX126x_SPI_SELECT = spiSelect;
-  SX126x_RESET      = reset;
-  SX126x_BUSY       = busy;
-  SX126x_INT0       = interrupt;
   txActive          = false;
+  __txDoneHook      = nullptr;
+  __rxDoneHook      = nullptr;
+  __rxPacketHook    = nullptr;
+  SpiBlockBytes     = 0;
+  SpiBlockMicros    = 0;
+  RxHead            = 0;
+  RxTail            = 0;
+  ServiceMode       = SX126X_SERVICE_MODE_ISR;
+  __serviceHook     = nullptr;
+  EventPending      = false;
+  EventTimestamp    = 0;
+  TxStatus          = ERR_NONE;
+  __txQueueDoneHook = nullptr;
+  TxQueueHead       = 0;
+  TxQueueTail       = 0;
+  TxId              = 0;
+  NextTxId          = 0;
+  InstanceSlot      = SX126X_NO_INSTANCE;
+  PacketType        = SX126X_PACKET_TYPE_LORA;
+  memset(ModulationParams, 0, sizeof(ModulationParams));
+  memset(PacketParams, 0, sizeof(PacketParams));
+  memset(GfskRegisters, 0, sizeof(GfskRegisters));
+  memset(DutyCycleBands, 0, sizeof(DutyCycleBands));
+  RfFrequency       = 0;
+  TxBand            = SX126X_NO_BAND;
+  TxReservedUs      = 0;
+  TxStartMicros     = 0;
+  CmdIssued         = 0;
+  CmdSuppressed     = 0;
+  SleepStartMs      = 0;
+  SleepStartMicros  = 0;
+  SleepTotalMs      = 0;
+  SniffPreamble     = 0;
+  CadSymbolNum      = SX126X_CAD_ON_2_SYMB;
+  CadDetPeak        = 0;
+  CadDetMin         = SX126X_CAD_DET_MIN;
+  CadRxIntervalMs   = 0;
+  CadRxDueMs        = 0;
+  CadRxPending      = false;
+  LbtMaxAttempts    = 0;
+  LbtSlotUs         = 0;
+  LbtAttempt        = 0;
+  LbtCadActive      = false;
+  LbtBackoff        = false;
+  LbtRetryMicros    = 0;
+  TxTimeoutMs       = 0;
+  RandomState       = 0;
+  __busyHook        = nullptr;
+  BusyTimeoutUs     = SX126X_BUSY_TIMEOUT_US;
+  BusyWaitUs        = 0;
+  BusyTimeouts      = 0;
+  memset(&Stats, 0, sizeof(Stats));
+  TxFragmentLen     = 0;
+  ProtocolFraming   = false;
+  __streamSource    = nullptr;
+  __streamTxHook    = nullptr;
+  __streamRxHook    = nullptr;
+  StreamTxData      = NULL;
+  StreamTxLen       = 0;
+  StreamTxSent      = 0;
+  StreamTxTimeoutMs = 0;
+  StreamTxCount     = 0;
+  StreamTxNext      = 0;
+  StreamTxId        = 0;
+  StreamTxActive    = false;
+  StreamRxBuffer    = NULL;
+  StreamRxMax       = 0;
+  StreamRxBytes     = 0;
+  StreamRxTotal     = 0;
+  StreamRxCount     = 0;
+  StreamRxNext      = 0;
+  StreamRxReceived  = 0;
+  StreamRxId        = 0;
+  StreamRxFragmentSize = 0;
+  StreamRxInTransfer = false;
+  __reliableTxHook  = nullptr;
+  memset(ArqTx, 0, sizeof(ArqTx));
+  ArqTxBase         = 0;
+  ArqTxNextSeq      = 0;
+  ArqTxSession      = 0;
+  ArqTxSeq          = 0;
+  ArqTxOnAir        = false;
+  ArqTxAckOnAir     = false;
+  ArqTxAckRequested = false;
+  ArqAckWait        = false;
+  ArqAckDeadline    = 0;
+  ArqRxEnabled      = false;
+  ArqRxSession      = 0;
+  ArqRxBase         = 0;
+  ArqRxBitmap       = 0;
+  ArqAckDue         = false;
+  __linkHook        = nullptr;
+  __hopHook         = nullptr;
+  LinkRates         = NULL;
+  LinkRateCount     = 0;
+  LinkRate          = 0;
+  LinkNextRate      = 0;
+  LinkPrevRate      = 0;
+  LinkMinPower      = 0;
+  LinkMaxPower      = 0;
+  LinkPower         = 0;
+  LinkNextPower     = 0;
+  LinkTargetQdb     = 0;
+  LinkLocalQdb      = 0;
+  LinkPeerQdb       = 0;
+  LinkPeerHeadQdb   = 0;
+  LinkLocalValid    = false;
+  LinkPeerValid     = false;
+  LinkState         = SX126X_LINK_STATE_IDLE;
+  LinkAttempts      = 0;
+  LinkTimerArmed    = false;
+  LinkDeadline      = 0;
+  LinkHeardMs       = 0;
+  LinkTxOnAir       = false;
+  LinkTxType        = 0;
+  LinkTxPending     = SX126X_LINK_NONE;
+  HopChannels       = NULL;
+  HopCount          = 0;
+  HopChannel        = 0;
+  HopMode           = SX126X_HOP_MANUAL;
+  __configHook      = nullptr;
+  SeqStep           = SX126X_SEQ_IDLE;
+  SeqStatus         = ERR_NONE;
+  SeqBlocking       = false;
+  SeqIssuing        = false;
+  SeqLoRaQueued     = false;
+  SeqStepMicros     = 0;
+  SeqHoldUs         = 0;
+  SeqBusyTimeouts   = 0;
+  SeqFrequencyInHz  = 0;
+  SeqTxPower        = 0;
+  SeqLoRaFrequencyInHz = 0;
+  memset(SeqRfFrequency, 0, sizeof(SeqRfFrequency));
+  memset(SeqModulationParams, 0, sizeof(SeqModulationParams));
+  memset(SeqPacketParams, 0, sizeof(SeqPacketParams));
+  InvalidateShadow();
+
+
+  Hal->Begin();
+}
+
+SX126x::~SX126x()
+{
+  DetachInstance();
+}
 
-  pinMode(SX126x_SPI_SELECT, OUTPUT);
-  pinMode(SX126x_RESET, OUTPUT);
-  pinMode(SX126x_BUSY, INPUT);
-  pinMode(SX126x_INT0, INPUT);
 
-  digitalWrite(SX126x_RESET, HIGH);
+//----------------------------------------------------------------------------------------------------------------------------
+//  Every radio takes one of SX126X_MAX_INSTANCES slots. Each slot has its own DIO1 trampoline, generated from the
+//  Dio1Isr<N> template, that calls Dio1Interrupt() on the instance in that slot, so dispatch costs one table lookup no
+//  matter how many radios there are.
+//
+//  Return value:
+//  false if all slots are taken
+//----------------------------------------------------------------------------------------------------------------------------
+bool SX126x::AttachInstance(void)
+{
+  if ( InstanceSlot < SX126X_MAX_INSTANCES ) {
+    return true;
+  }
+
+  for ( uint8_t i = 0; i < SX126X_MAX_INSTANCES; i++ ) 
+  {
+    if ( Instances[i] == nullptr ) 
+    {
+      Instances[i] = this;
+      InstanceSlot = i;
+      Hal->AttachDio1(Dio1IsrAt<SX126X_MAX_INSTANCES>(i));
+      return true;
+    }
+  }
+
+  return false;
+}
+
 
-  SPI.begin();
+void SX126x::DetachInstance(void)
+{
+  if ( InstanceSlot < SX126X_MAX_INSTANCES ) 
+  {
+    Hal->DetachDio1();
+    Instances[InstanceSlot] = nullptr;
+    InstanceSlot = SX126X_NO_INSTANCE;
+  }
 }
 
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Resets and sets up the chip: regulator, RF switch, TCXO, calibration, PA and frequency. Blocks until the chip is done;
+//  ModuleConfigAsync() runs the same sequence from Service().
+//
+//  Return value:
+//  ERR_NONE, ERR_UNSUPPORTED_MODE for an unknown packet type, ERR_UNKNOWN or ERR_INVALID_MODE if the chip does not answer
+//  in STDBY_RC, ERR_CALIBRATION_FAILED, ERR_BUSY_TIMEOUT or ERR_DEVICE_BUSY while ModuleConfigAsync() is still running
+//----------------------------------------------------------------------------------------------------------------------------
 uint8_t SX126x::ModuleConfig(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode) 
 {
+  uint8_t rv = StartModuleConfig(packetType, frequencyInHz, txPowerInDbm, defaultMode);
+  if ( rv == ERR_NONE ) {
+    rv = RunSequence(true);
+  }
+  return rv;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Starts ModuleConfig() without waiting for the chip. The reset, the TCXO start up and the calibrations keep BUSY high
+//  for several ms in total; the sequence only sends the next command once BUSY has fallen, and that is checked by
+//  Service(), so call it from loop() until the config done hook runs or ConfigPending() returns false. A LoRaBeginAsync()
+//  made meanwhile is queued behind it. Sending, receiving and sleeping return ERR_DEVICE_BUSY until the sequence ends.
+//
+//  Parameters:
+//  see ModuleConfig()
+//
+//  Return value:
+//  ERR_NONE if the sequence was started, ERR_UNSUPPORTED_MODE or ERR_DEVICE_BUSY while a sequence is running. The result
+//  of the sequence itself goes to the config done hook.
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::ModuleConfigAsync(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode) 
+{
+  uint8_t rv = StartModuleConfig(packetType, frequencyInHz, txPowerInDbm, defaultMode);
+  if ( rv == ERR_NONE ) {
+    RunSequence(false);
+  }
+  return rv;
+}
+
+
+uint8_t SX126x::StartModuleConfig(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode)
+{
+  if ( ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+  if ( packetType != SX126X_PACKET_TYPE_LORA && packetType != SX126X_PACKET_TYPE_GFSK ) {
+    return ERR_UNSUPPORTED_MODE;
+  }
+
   if ( txPowerInDbm > 22 )
     txPowerInDbm = 22;
   if ( txPowerInDbm < -3 )
     txPowerInDbm = -3;
 
-  uint8_t rv = ERR_NONE;
   DefaultMode = defaultMode;
+  PacketType  = packetType;
+  SeqFrequencyInHz = frequencyInHz;
+  SeqTxPower  = txPowerInDbm;
+
+  if ( !AttachInstance() ) {
+#ifdef ARDUINO
+    Serial.println("SX126x: WARNING! More LoRa modules than SX126X_MAX_INSTANCES on a single host!");
+#endif
+  }
+
+  StartSequence(SX126X_SEQ_RESET);
+  return ERR_NONE;
+}
 
-  if ( module1_ptr == nullptr ) {
-    module1_ptr = this;
-    attachInterrupt(digitalPinToInterrupt(SX126x_INT0), DIO1_ISR_1, RISING);
+
+uint8_t SX126x::LoRaBegin(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq) 
+{
+  return LoRaBegin(SX126xLoRaProfile(0, spreadingFactor, bandwidth, codingRate, preambleLength, headerMode, crcOn, invertIrq));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Applies a LoRa profile. The command parameters were computed when the profile was built, nothing is derived here.
+//
+//  Parameters:
+//  profile - modulation, packet and (unless 0) frequency settings
+//
+//  Return value:
+//  ERR_NONE, ERR_BUSY_TIMEOUT or ERR_DEVICE_BUSY while an async sequence is running
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::LoRaBegin(const SX126xLoRaProfile& profile) 
+{
+  if ( ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
   }
-  else if ( module2_ptr == nullptr ) {
-    module2_ptr = this;
-    attachInterrupt(digitalPinToInterrupt(SX126x_INT0), DIO1_ISR_2, RISING);
+
+  SetLoRaProfile(profile);
+  StartSequence(SX126X_SEQ_LORA);
+  return RunSequence(true);
+}
+
+
+uint8_t SX126x::LoRaBeginAsync(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq) 
+{
+  return LoRaBeginAsync(SX126xLoRaProfile(0, spreadingFactor, bandwidth, codingRate, preambleLength, headerMode, crcOn, invertIrq));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Starts LoRaBegin() without waiting for the chip, or queues it behind a running ModuleConfigAsync(). See
+//  ModuleConfigAsync() for how the sequence is driven.
+//
+//  Return value:
+//  ERR_NONE or ERR_DEVICE_BUSY if a LoRaBeginAsync() is already running or queued
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::LoRaBeginAsync(const SX126xLoRaProfile& profile) 
+{
+  if ( SeqLoRaQueued || SeqStep >= SX126X_SEQ_LORA ) {
+    return ERR_DEVICE_BUSY;
   }
-  else {
-    Serial.println("SX126x: WARNING! This library only supports a max of 2 LoRa modules on a single host!");
+
+  SetLoRaProfile(profile);
+  if ( ConfigPending() ) {
+    SeqLoRaQueued = true;
   }
-  
-  Reset();
-  SetStandby(SX126X_STANDBY_RC);
-  
-  uint8_t currentMode = GetCurrentMode();
-  if ( currentMode != SX126X_STATUS_MODE_STDBY_RC )
+  else 
   {
-    Serial.println("SX126x: error, maybe no SPI connection?");
-    return (currentMode == 0) ? ERR_UNKNOWN : ERR_INVALID_MODE;
+    StartSequence(SX126X_SEQ_LORA);
+    RunSequence(false);
   }
+  return ERR_NONE;
+}
 
-  if ( packetType == SX126X_PACKET_TYPE_LORA) {
-    SetPacketType(SX126X_PACKET_TYPE_LORA); 
-    //RadioSetModem( ( SX126x.ModulationParams.PacketType == PACKET_TYPE_GFSK ) ? MODEM_FSK : MODEM_LORA );
-  }
-  else {
-    return ERR_UNSUPPORTED_MODE;
+
+void SX126x::SetLoRaProfile(const SX126xLoRaProfile& profile)
+{
+  SeqLoRaFrequencyInHz = profile.frequencyInHz;
+  memcpy(SeqRfFrequency, profile.rfFrequency, sizeof(SeqRfFrequency));
+  memcpy(SeqModulationParams, profile.modulationParams, sizeof(SeqModulationParams));
+  memcpy(SeqPacketParams, profile.packetParams, sizeof(SeqPacketParams));
+}
+
+
+// true while a configuration sequence started by ModuleConfigAsync() or LoRaBeginAsync() has not finished
+bool SX126x::ConfigPending(void)
+{
+  return SeqStep != SX126X_SEQ_IDLE;
+}
+
+
+// called with the result of ModuleConfigAsync() (and a LoRaBeginAsync() queued behind it) or of LoRaBeginAsync()
+void SX126x::setConfigDoneHook(void (*configHook)(SX126x* radio, uint8_t status))
+{
+  __configHook = configHook;
+}
+
+
+void SX126x::StartSequence(uint8_t step)
+{
+  if ( step != SX126X_SEQ_RESET ) {
+    WakeIfAsleep();
   }
 
-  ClearDeviceErrors();
-  SetRegulatorMode(SX126X_REGULATOR_DC_DC);
-  SetDio2AsRfSwitchCtrl(true);
-  SetDio3AsTcxoCtrl(SX126X_DIO3_OUTPUT_1_8, SX126X_TCXO_SETUP_TIME);
-  
-  Calibrate( SX126X_CALIBRATE_ALL_BLOCKS );
-  uint16_t errors = GetDeviceErrors();
+  SeqStep          = step;
+  SeqStatus        = ERR_NONE;
+  SeqBusyTimeouts  = BusyTimeouts;
+  SeqStepMicros    = Hal->Micros();
+  SeqHoldUs        = 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Runs the configuration sequence. Every step sends the commands of one stage and returns without waiting for BUSY,
+//  the next step is only run once BUSY has fallen (and a hold time, used for the reset pulse, has passed). Blocking, the
+//  waits are done here; otherwise the sequence returns at the first wait and continues on the next call from Service().
+//  Inside a step SPItransfer() still waits for BUSY before every command, so a command with a long BUSY time (reset,
+//  TCXO start up, calibration, image calibration) is always the last one of its step. The commands in front of it only
+//  keep BUSY high for a few us, and no step waits for the BUSY of the step before.
+//
+//  Parameters:
+//  blocking - wait for the chip instead of returning
+//
+//  Return value:
+//  result of the sequence when blocking, ERR_NONE otherwise
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::RunSequence(bool blocking)
+{
+  SeqBlocking = blocking;
+
+  while ( SeqStep != SX126X_SEQ_IDLE ) 
+  {
+    uint32_t elapsed = Hal->Micros() - SeqStepMicros;
+    if ( elapsed < SeqHoldUs ) 
+    {
+      if ( !blocking ) {
+        return ERR_NONE;
+      }
+      Hal->DelayMicroseconds(SeqHoldUs - elapsed);
+    }
+
+    // BUSY means nothing before and during the reset pulse, e.g. it is high while the chip sleeps
+    bool waitBusy = (SeqStep != SX126X_SEQ_RESET && SeqStep != SX126X_SEQ_RESET_RELEASE);
+    if ( waitBusy && blocking ) 
+    {
+      if ( WaitOnBusy() != ERR_NONE ) {
+        FinishSequence(ERR_BUSY_TIMEOUT);
+      }
+    }
+    else if ( waitBusy && Hal->ReadBusy() ) 
+    {
+      if ( elapsed >= SeqHoldUs + BusyTimeoutUs ) 
+      {
+        BusyWaitUs += elapsed;
+        BusyTimeouts++;
+        FinishSequence(ERR_BUSY_TIMEOUT);
+      }
+      return ERR_NONE;
+    }
 
-  if ( errors & SX126X_MASK_CALIB_ERR ) {
-    Serial.print("SX126x: error, calibration failed: 0b");
-    Serial.println(errors, BIN);
-    rv = ERR_CALIBRATION_FAILED;
+    if ( SeqStep != SX126X_SEQ_IDLE ) 
+    {
+      SeqHoldUs = 0;
+      SeqIssuing = true;
+      RunSequenceStep();
+      SeqIssuing = false;
+      SeqStepMicros = Hal->Micros();
+    }
   }
 
-  SetStandby(SX126X_STANDBY_RC); 
-  SetBufferBaseAddress(0, 0);
-  SetPaConfig(0x04, 0x07, 0x00, 0x01);
-  SetPowerConfig(txPowerInDbm, SX126X_PA_RAMP_800U);
-  SetRfFrequency(frequencyInHz);
+  return blocking ? SeqStatus : ERR_NONE;
+}
 
-  return rv;
+
+void SX126x::RunSequenceStep(void)
+{
+  uint8_t step = SeqStep++;
+
+  switch ( step ) 
+  {
+    case SX126X_SEQ_RESET:
+      Hal->WriteReset(false);
+      SeqHoldUs = 600;
+      break;
+
+    case SX126X_SEQ_RESET_RELEASE:
+      Hal->WriteReset(true);
+      InvalidateShadow();
+      break;
+
+    case SX126X_SEQ_STANDBY:
+      SetStandby(SX126X_STANDBY_RC);
+      break;
+
+    case SX126X_SEQ_CHECK_MODE:
+    {
+      uint8_t currentMode = GetCurrentMode();
+      if ( currentMode != SX126X_STATUS_MODE_STDBY_RC )
+      {
+#ifdef ARDUINO
+        Serial.println("SX126x: error, maybe no SPI connection?");
+#endif
+        FinishSequence((currentMode == 0) ? ERR_UNKNOWN : ERR_INVALID_MODE);
+        break;
+      }
+      SetPacketType(PacketType);
+      ClearDeviceErrors();
+      SetRegulatorMode(SX126X_REGULATOR_DC_DC);
+      SetDio2AsRfSwitchCtrl(true);
+      break;
+    }
+
+    case SX126X_SEQ_TCXO:
+      SetDio3AsTcxoCtrl(SX126X_DIO3_OUTPUT_1_8, SX126X_TCXO_SETUP_TIME);
+      break;
+
+    case SX126X_SEQ_CALIBRATE:
+      Calibrate(SX126X_CALIBRATE_ALL_BLOCKS);
+      break;
+
+    case SX126X_SEQ_CHECK_CALIBRATION:
+    {
+      uint16_t errors = GetDeviceErrors();
+      if ( errors & SX126X_MASK_CALIB_ERR ) 
+      {
+#ifdef ARDUINO
+        Serial.print("SX126x: error, calibration failed: 0b");
+        Serial.println(errors, BIN);
+#endif
+        SeqStatus = ERR_CALIBRATION_FAILED;
+      }
+      SetStandby(SX126X_STANDBY_RC);
+      SetBufferBaseAddress(0, 0);
+      SetPaConfig(0x04, 0x07, 0x00, 0x01);
+      SetPowerConfig(SeqTxPower, SX126X_PA_RAMP_800U);
+      break;
+    }
+
+    case SX126X_SEQ_CALIBRATE_IMAGE:
+      CalibrateImage(SeqFrequencyInHz);
+      break;
+
+    // the image calibration was the step before, so unlike SetRfFrequency() this only sends the frequency
+    case SX126X_SEQ_FREQUENCY:
+    {
+      uint32_t freq = SX126xFrequencyWord(SeqFrequencyInHz);
+      uint8_t buf[4] = { (uint8_t)(freq >> 24), (uint8_t)(freq >> 16), (uint8_t)(freq >> 8), (uint8_t)freq };
+      SPIwriteCommand(SX126X_CMD_SET_RF_FREQUENCY, buf, 4);
+      RfFrequency = SeqFrequencyInHz;
+      if ( !SeqLoRaQueued ) {
+        FinishSequence(SeqStatus);
+      }
+      SeqLoRaQueued = false;
+      break;
+    }
+
+    // switching back from GFSK, the packet type can only be changed in standby
+    case SX126X_SEQ_LORA:
+      if ( PacketType != SX126X_PACKET_TYPE_LORA ) 
+      {
+        SetStandby(SX126X_STANDBY_RC);
+        SetPacketType(SX126X_PACKET_TYPE_LORA);
+        PacketType = SX126X_PACKET_TYPE_LORA;
+      }
+      SetStopRxTimerOnPreambleDetect(false);
+      SetLoRaSymbNumTimeout(0);
+      if ( SeqLoRaFrequencyInHz != 0 ) {
+        CalibrateImage(SeqLoRaFrequencyInHz);
+      }
+      break;
+
+    case SX126X_SEQ_LORA_MODEM:
+      if ( SeqLoRaFrequencyInHz != 0 ) 
+      {
+        SPIwriteCommand(SX126X_CMD_SET_RF_FREQUENCY, SeqRfFrequency, 4);
+        RfFrequency = SeqLoRaFrequencyInHz;
+      }
+
+      memcpy(ModulationParams, SeqModulationParams, sizeof(SeqModulationParams));
+      SPIwriteCommand(SX126X_CMD_SET_MODULATION_PARAMS, ModulationParams, 4);
+
+      memcpy(PacketParams, SeqPacketParams, sizeof(SeqPacketParams));
+      SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, SX126X_LORA_PACKET_PARAMS);
+      SetDioIrqParams(SX126X_IRQ_ALL,   //all interrupts enabled
+                      SX126X_IRQ_RX_DONE | SX126X_IRQ_TX_DONE | SX126X_IRQ_TIMEOUT | SX126X_IRQ_CAD_DONE, //interrupts on DIO1
+                      SX126X_IRQ_NONE,  //interrupts on DIO2
+                      SX126X_IRQ_NONE); //interrupts on DIO3
+      ClearIrqStatus(SX126X_IRQ_ALL);
+      break;
+
+    // Enter the default mode of operation
+    case SX126X_SEQ_LORA_DEFAULT_MODE:
+      EnterDefaultMode();
+      FinishSequence(SeqStatus);
+      break;
+  }
 }
 
 
-uint8_t SX126x::LoRaBegin(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq) 
+void SX126x::FinishSequence(uint8_t status)
 {
+  if ( status == ERR_NONE && BusyTimeouts != SeqBusyTimeouts ) {
+    status = ERR_BUSY_TIMEOUT;
+  }
+#ifdef ARDUINO
+  if ( status == ERR_BUSY_TIMEOUT ) {
+    Serial.println("SX126x: error, BUSY stuck high");
+  }
+#endif
+
+  SeqStep = SX126X_SEQ_IDLE;
+  SeqLoRaQueued = false;
+  SeqStatus = status;
+  if ( !SeqBlocking && __configHook != nullptr ) {
+    __configHook(this, status);
+  }
+}
 
-  uint16_t chipsPerSymbol = pow( 2.0, spreadingFactor );
-  SymbolRate = ((float)SX126X_LORA_BANDWIDTHS[bandwidth]) / ((float)chipsPerSymbol);
 
-  //Serial.println("SX126x: SymbolRate: " + String(SymbolRate) + "bps");
+//----------------------------------------------------------------------------------------------------------------------------
+//  Switches the radio to GFSK for high bit rate links. Packets have a variable length (up to 255 bytes), so TX, RX, the
+//  hooks, the queues and GetTimeOnAir() work as in LoRa mode. Listen before talk, ReceiveDutyCycle() and ReceiveCad()
+//  need LoRa and are not available in GFSK. LoRaBegin() switches back.
+//
+//  Parameters:
+//  bitRate            - SX126X_GFSK_BIT_RATE_MIN to SX126X_GFSK_BIT_RATE_MAX bps
+//  frequencyDeviation - up to SX126X_GFSK_FREQUENCY_DEVIATION_MAX Hz
+//  rxBandwidth        - SX126X_GFSK_RX_BW_*, should be at least bit rate + 2 * deviation
+//  pulseShape         - SX126X_GFSK_FILTER_*
+//  preambleLength     - preamble in bits, at least 16; the preamble detector is set to half of it, 8 to 16 bits
+//  syncWord           - sync word, 1 to SX126X_GFSK_SYNC_WORD_MAX bytes
+//  crcType            - SX126X_GFSK_CRC_*
+//  whitening          - data whitening on/off
+//  addressFilter      - SX126X_GFSK_ADDRESS_FILT_*, packets then carry the address byte after the length
+//  nodeAddress, broadcastAddress - addresses accepted by the filter
+//
+//  Return value:
+//  ERR_NONE, ERR_INVALID_* for the first invalid parameter, ERR_BUSY_TIMEOUT or ERR_DEVICE_BUSY during a configuration
+//  sequence
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::GfskBegin(uint32_t bitRate, uint32_t frequencyDeviation, uint8_t rxBandwidth, uint8_t pulseShape, uint16_t preambleLength,
+                          const uint8_t *syncWord, uint8_t syncWordLength, uint8_t crcType, bool whitening,
+                          uint8_t addressFilter, uint8_t nodeAddress, uint8_t broadcastAddress)
+{
+  if ( ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+  if ( bitRate < SX126X_GFSK_BIT_RATE_MIN || bitRate > SX126X_GFSK_BIT_RATE_MAX ) {
+    return ERR_INVALID_BIT_RATE;
+  }
+  if ( frequencyDeviation > SX126X_GFSK_FREQUENCY_DEVIATION_MAX ) {
+    return ERR_INVALID_FREQUENCY_DEVIATION;
+  }
+  if ( !IsGfskRxBandwidth(rxBandwidth) ) {
+    return ERR_INVALID_RX_BANDWIDTH;
+  }
+  if ( pulseShape != SX126X_GFSK_FILTER_NONE && (pulseShape < SX126X_GFSK_FILTER_GAUSS_0_3 || pulseShape > SX126X_GFSK_FILTER_GAUSS_1) ) {
+    return ERR_INVALID_DATA_SHAPING;
+  }
+  if ( preambleLength < 16 ) {
+    return ERR_INVALID_PREAMBLE_LENGTH;
+  }
+  if ( syncWord == NULL || syncWordLength == 0 || syncWordLength > SX126X_GFSK_SYNC_WORD_MAX ) {
+    return ERR_INVALID_SYNC_WORD;
+  }
+  if ( crcType != SX126X_GFSK_CRC_OFF && crcType != SX126X_GFSK_CRC_1_BYTE && crcType != SX126X_GFSK_CRC_2_BYTE &&
+       crcType != SX126X_GFSK_CRC_1_BYTE_INV && crcType != SX126X_GFSK_CRC_2_BYTE_INV ) {
+    return ERR_INVALID_CRC_TYPE;
+  }
+  if ( addressFilter > SX126X_GFSK_ADDRESS_FILT_NODE_BROADCAST ) {
+    return ERR_INVALID_ADDRESS_FILTER;
+  }
+
+  uint32_t busyTimeouts = BusyTimeouts;
 
-  uint8_t ldro = SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_OFF; //LowDataRateOptimize
-  if ( 1.0/SymbolRate > SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_THRESH )
+  if ( PacketType != SX126X_PACKET_TYPE_GFSK ) 
   {
-    //Serial.println("SX126x: Enabling Low Data Rate Optimize");
-    ldro = SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_ON; //LowDataRateOptimize
+    SetStandby(SX126X_STANDBY_RC);
+    SetPacketType(SX126X_PACKET_TYPE_GFSK);
+    PacketType = SX126X_PACKET_TYPE_GFSK;
   }
-  
 
   SetStopRxTimerOnPreambleDetect(false);
-  SetLoRaSymbNumTimeout(0);
-  SetModulationParams(spreadingFactor, bandwidth, codingRate, ldro);
-  
-  PacketParams[0] = (preambleLength >> 8) & 0xFF;
-  PacketParams[1] = preambleLength;
-  PacketParams[2] = headerMode;
-
-  if ( crcOn )
-    PacketParams[4] = SX126X_LORA_CRC_ON;
-  else
-    PacketParams[4] = SX126X_LORA_CRC_OFF;
 
-  if ( invertIrq )
-    PacketParams[5] = SX126X_LORA_IQ_STANDARD;
-  else
-    PacketParams[5] = SX126X_LORA_IQ_INVERTED;
+  uint32_t bitRateWord = SX126xGfskBitRateWord(bitRate);
+  uint32_t deviationWord = SX126xFrequencyWord(frequencyDeviation);
+  memset(ModulationParams, 0, sizeof(ModulationParams));
+  ModulationParams[0] = (uint8_t)(bitRateWord >> 16);
+  ModulationParams[1] = (uint8_t)(bitRateWord >> 8);
+  ModulationParams[2] = (uint8_t)bitRateWord;
+  ModulationParams[3] = pulseShape;
+  ModulationParams[4] = rxBandwidth;
+  ModulationParams[5] = (uint8_t)(deviationWord >> 16);
+  ModulationParams[6] = (uint8_t)(deviationWord >> 8);
+  ModulationParams[7] = (uint8_t)deviationWord;
+  SPIwriteCommand(SX126X_CMD_SET_MODULATION_PARAMS, ModulationParams, 8);
+
+  PacketParams[0] = (uint8_t)(preambleLength >> 8);
+  PacketParams[1] = (uint8_t)preambleLength;
+  PacketParams[2] = (preambleLength >= 32) ? SX126X_GFSK_PREAMBLE_DETECT_16 : SX126X_GFSK_PREAMBLE_DETECT_8;
+  PacketParams[3] = 8 * syncWordLength;
+  PacketParams[4] = addressFilter;
+  PacketParams[5] = SX126X_GFSK_PACKET_VARIABLE;
+  PacketParams[6] = SX126X_BUFFER_SIZE - 1;
+  PacketParams[7] = crcType;
+  PacketParams[8] = whitening ? SX126X_GFSK_WHITENING_ON : SX126X_GFSK_WHITENING_OFF;
+  SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, SX126X_GFSK_PACKET_PARAMS);
+
+  memset(GfskRegisters, 0, sizeof(GfskRegisters));
+  memcpy(GfskRegisters, syncWord, syncWordLength);
+  GfskRegisters[SX126X_GFSK_SYNC_WORD_MAX] = nodeAddress;
+  GfskRegisters[SX126X_GFSK_SYNC_WORD_MAX + 1] = broadcastAddress;
+  WriteGfskRegisters();
 
-  SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, 6);
   SetDioIrqParams(SX126X_IRQ_ALL,   //all interrupts enabled
                   SX126X_IRQ_RX_DONE | SX126X_IRQ_TX_DONE | SX126X_IRQ_TIMEOUT, //interrupts on DIO1
                   SX126X_IRQ_NONE,  //interrupts on DIO2
                   SX126X_IRQ_NONE); //interrupts on DIO3
-				  
+
   ClearIrqStatus(SX126X_IRQ_ALL);
 
   // Enter the default mode of operation
   EnterDefaultMode();
+
+  return (BusyTimeouts != busyTimeouts) ? ERR_BUSY_TIMEOUT : ERR_NONE;
 }
 
 
-uint8_t SX126x::Receive(uint8_t *pData, uint16_t *len) 
+//----------------------------------------------------------------------------------------------------------------------------
+//  Puts the radio into warm sleep, where the chip keeps its configuration, and records that configuration in a host side
+//  record. After the host wakes up (or reboots with the record kept in retained memory), WarmStart() brings the radio
+//  back without the reset, calibration and configuration ModuleConfig() and LoRaBegin() go through.
+//
+//  The next SendAsync(), ReceiveMode() or any other call that talks to the chip wakes it again. After a cold sleep the
+//  driver rewrites the configuration when it wakes the chip, and the record is marked invalid for WarmStart().
+//
+//  Parameters:
+//  retained    - record to fill, may be NULL if this instance itself will be woken
+//  sleepConfig - SX126X_SLEEP_START_WARM or SX126X_SLEEP_START_COLD, optionally | SX126X_SLEEP_RTC_ON
+//
+//  Return value:
+//  ERR_NONE or ERR_DEVICE_BUSY while a transmission or configuration sequence is in progress
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::Sleep(SX126xRetainedConfig* retained, uint8_t sleepConfig)
 {
-  uint8_t rv = ERR_NONE;
-  uint16_t irq = GetIrqStatus();
-  
-  if( irq & SX126X_IRQ_RX_DONE )
-  {
-    ClearIrqStatus(SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT);
-    rv = ReadBuffer(pData, len);
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
   }
-  else if ( irq & SX126X_IRQ_TIMEOUT) {
-    rv = ERR_RX_TIMEOUT;
+
+  if ( retained != NULL && !(sleepConfig & SX126X_SLEEP_START_WARM) ) {
+    retained->magic = 0;
   }
-  else {
-    *len = 0;
-    rv = ERR_NONE;
+  else if ( retained != NULL ) 
+  {
+    retained->magic       = SX126X_RETAINED_MAGIC;
+    retained->packetType  = PacketType;
+    retained->defaultMode = DefaultMode;
+    retained->rfFrequency = RfFrequency;
+    memcpy(retained->modulationParams, ModulationParams, sizeof(retained->modulationParams));
+    memcpy(retained->packetParams, PacketParams, sizeof(retained->packetParams));
+    memcpy(retained->gfskRegisters, GfskRegisters, sizeof(retained->gfskRegisters));
+    memcpy(retained->shadowParams, ShadowParams, sizeof(retained->shadowParams));
   }
-  
-  return rv;
+
+  SetSleep(sleepConfig);
+
+  return ERR_NONE;
 }
 
 
-uint8_t SX126x::Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs)
+//----------------------------------------------------------------------------------------------------------------------------
+//  Fast boot path replacing ModuleConfig() and LoRaBegin() for a radio put into warm sleep by Sleep(). The chip is woken
+//  and checked: it must come up in STDBY_RC with the packet type of the record, which a reset or power loss would have
+//  cleared. The host state (modulation, packet parameters, frequency and the command shadow) is restored from the
+//  record, so nothing is recalibrated or written again. Only the DIO1 binding, which lives on the host, is redone.
+//
+//  Parameters:
+//  retained - record written by Sleep()
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN if the record is not valid, ERR_INVALID_MODE if the chip lost its configuration; use
+//  ModuleConfig() and LoRaBegin() in both cases
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::WarmStart(const SX126xRetainedConfig* retained)
 {
-  uint16_t irq;
-  bool rv = SendAsync(pData, len, timeoutInMs);
+  if ( retained == NULL || retained->magic != SX126X_RETAINED_MAGIC ) {
+    return ERR_UNKNOWN;
+  }
+  if ( ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
 
-  if ( rv == ERR_NONE ) 
+  if ( !AttachInstance() ) {
+#ifdef ARDUINO
+    Serial.println("SX126x: WARNING! More LoRa modules than SX126X_MAX_INSTANCES on a single host!");
+#endif
+  }
+
+  if ( Wakeup() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+  if ( GetCurrentMode() != SX126X_STATUS_MODE_STDBY_RC || GetPacketType() != retained->packetType ) 
   {
-    while ( txActive ) {}
-    irq = GetIrqStatus();
+    InvalidateShadow();
+    return ERR_INVALID_MODE;
+  }
 
-    EnterDefaultMode();
+  PacketType  = retained->packetType;
+  DefaultMode = retained->defaultMode;
+  RfFrequency = retained->rfFrequency;
+  memcpy(ModulationParams, retained->modulationParams, sizeof(ModulationParams));
+  memcpy(PacketParams, retained->packetParams, sizeof(PacketParams));
+  memcpy(GfskRegisters, retained->gfskRegisters, sizeof(GfskRegisters));
+  memcpy(ShadowParams, retained->shadowParams, sizeof(ShadowParams));
+  ChipMode = SX126X_STATUS_MODE_STDBY_RC;
+  IrqMaybeSet = SX126X_IRQ_ALL;
+
+  ClearIrqStatus(SX126X_IRQ_ALL);
+  EnterDefaultMode();
+
+  return ERR_NONE;
+}
+
+
+uint8_t SX126x::Receive(uint8_t *pData, uint16_t *len) 
+{
+  uint8_t rv = ERR_NONE;
+  uint16_t irq = GetIrqStatus();
+  
+  if( irq & SX126X_IRQ_RX_DONE )
+  {
+    ClearIrqStatus(SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT | SX126X_IRQ_CRC_ERR | SX126X_IRQ_HEADER_ERR);
+    rv = ReadBuffer(pData, len);
+
+    if ( irq & SX126X_IRQ_CRC_ERR ) {
+      rv = ERR_CRC_MISMATCH;
+    }
+    else if ( ProtocolFraming && rv == ERR_NONE && *len > 0 && pData[0] == SX126X_ESCAPE_MARKER ) 
+    {
+      *len -= 1;
+      memmove(pData, pData + 1, *len);
+    }
+  }
+  else if ( irq & SX126X_IRQ_TIMEOUT) {
+    rv = ERR_RX_TIMEOUT;
+  }
+  else {
+    *len = 0;
+    rv = ERR_NONE;
+  }
+  
+  return rv;
+}
+
+
+uint8_t SX126x::Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs)
+{
+  uint8_t rv = SendAsync(pData, len, timeoutInMs);
 
-    if ( irq & SX126X_IRQ_TIMEOUT ) {
-      rv = ERR_TX_TIMEOUT;
+  if ( rv == ERR_NONE ) 
+  {
+    // without an executor hook nobody else will call Service() in deferred mode, and only Service() ends a listen
+    // before talk backoff
+    while ( txActive ) {
+      Hal->Yield();
+      if ( (ServiceMode == SX126X_SERVICE_MODE_DEFERRED && __serviceHook == nullptr) || LbtBackoff ) {
+        Service();
+      }
     }
+    rv = TxStatus;
   }
 	
 	return rv;
@@ -190,115 +926,2406 @@ uint8_t SX126x::Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs)
 
 uint8_t SX126x::SendAsync(uint8_t *pData, uint16_t len, uint32_t timeoutInMs) 
 {
-  bool rv = ERR_NONE;
+  uint8_t rv = ERR_NONE;
+  uint8_t escape = ProtocolFraming ? EscapeLength(pData, len) : 0;
 
-  if ( txActive ) {
+  if ( txActive || StreamTxActive || ConfigPending() ) {
+    rv = ERR_DEVICE_BUSY;
+  }
+  else if ( len + escape >= SX126X_BUFFER_SIZE ) {
+    rv = ERR_PACKET_TOO_LONG;
+  }
+  else if ( !DutyCycleAllows(len + escape) ) {
+    rv = ERR_DUTY_CYCLE;
+  }
+  else 
+  {
+    txActive = true;
+    TxId = NextTxId++;
+    TxFragmentLen = 0;
+    rv = StartTx(pData, len, timeoutInMs, SX126X_ESCAPE_HEADER, escape);
+    if ( rv == ERR_BUSY_TIMEOUT ) {
+      txActive = false;
+    }
+  }
+
+  return rv;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Queues a frame for transmission. If the radio is idle the frame is sent right away, otherwise it is started from the
+//  TX_DONE handling of the frame before it, so back to back frames leave the radio idle only for the time it takes to
+//  load the next payload. The data is not copied: pData must stay valid until the frame's TX done hook has been called.
+//  A frame that does not fit in the duty cycle budget of its sub-band stays queued and is started by Service() once
+//  enough airtime has been earned back.
+//
+//  Parameters:
+//  pData, len:   frame to send, with protocol framing one byte shorter if it starts with a reserved byte
+//  timeoutInMs:  TX timeout, see SetTx(), or SX126X_TIMEOUT_AUTO to derive it from the frame's time on air
+//  queueId:      optional, receives the ID the frame's completion will be reported with
+//
+//  Return value:
+//  ERR_NONE, ERR_PACKET_TOO_LONG or ERR_DEVICE_BUSY when all SX126X_TX_QUEUE_DEPTH entries are in use or a stream is
+//  being sent
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::SendQueued(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, uint8_t *queueId)
+{
+  uint8_t escape = ProtocolFraming ? EscapeLength(pData, len) : 0;
+
+  if ( len + escape >= SX126X_BUFFER_SIZE ) {
+    return ERR_PACKET_TOO_LONG;
+  }
+  if ( StreamTxActive || TxQueueCount() >= SX126X_TX_QUEUE_DEPTH ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  uint8_t id = QueueFrame(pData, len, timeoutInMs, SX126X_ESCAPE_HEADER, escape);
+  if ( queueId != NULL ) {
+    *queueId = id;
+  }
+
+  // The TX_DONE handler only looks at the queue while txActive is set, so if the radio went idle before the frame was
+  // published above, nobody else will start it.
+  if ( !txActive && !ConfigPending() && DutyCycleAllows(len + escape) ) 
+  {
+    txActive = true;
+    StartQueuedTx();
+  }
+
+  return ERR_NONE;
+}
+
+
+// publishes a frame at the head of the TX queue without starting it, returns its ID
+uint8_t SX126x::QueueFrame(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, const uint8_t *header, uint8_t headerLen)
+{
+  SX126xTxFrame* frame = &TxQueue[TxQueueHead % SX126X_TX_QUEUE_DEPTH];
+  frame->data = pData;
+  frame->len = len;
+  frame->timeoutInMs = timeoutInMs;
+  frame->id = NextTxId++;
+  frame->headerLen = headerLen;
+  if ( headerLen > 0 ) {
+    memcpy(frame->header, header, headerLen);
+  }
+  TxQueueHead = (TxQueueHead + 1) % (2 * SX126X_TX_QUEUE_DEPTH);
+
+  return frame->id;
+}
+
+
+// frames waiting in the TX queue, plus one while a frame is on air or the radio is being configured; 0 = free to send
+uint8_t SX126x::GetTxBacklog(void)
+{
+  return TxQueueCount() + ((txActive || ConfigPending()) ? 1 : 0);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Reserves the first bytes SX126X_RESERVED_FIRST to SX126X_RESERVED_LAST for the driver's own frames: stream fragments,
+//  ReliableSend() frames and acknowledgements, and link adaptation frames. While on, Send(), SendAsync() and SendQueued()
+//  put SX126X_ESCAPE_MARKER in front of an application frame that starts with a reserved byte, so it can not be taken for
+//  one of them, and received frames that start with SX126X_ESCAPE_MARKER lose it again. Such frames are one byte longer
+//  on air and can be at most 254 bytes long. Turn it on at both ends of a link that uses these protocols for application
+//  frames as well.
+//
+//  Off by default: frames go on air exactly as given and are received as they came. A frame that starts like a frame of
+//  an armed protocol is then taken by it if its header is valid.
+//
+//  Parameters:
+//  enable - true to escape and unescape application frames
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::SetProtocolFraming(bool enable)
+{
+  ProtocolFraming = enable;
+}
+
+
+uint8_t SX126x::TxQueueCount(void)
+{
+  return (TxQueueHead + 2 * SX126X_TX_QUEUE_DEPTH - TxQueueTail) % (2 * SX126X_TX_QUEUE_DEPTH);
+}
+
+
+// pops the oldest queued frame and starts it, txActive must already be set
+void SX126x::StartQueuedTx(void)
+{
+  SX126xTxFrame* frame = &TxQueue[TxQueueTail % SX126X_TX_QUEUE_DEPTH];
+  TxId = frame->id;
+  TxFragmentLen = (frame->headerLen == SX126X_STREAM_HEADER_SIZE) ? frame->len : 0;
+  TxQueueTail = (TxQueueTail + 1) % (2 * SX126X_TX_QUEUE_DEPTH);
+  if ( StartTx(frame->data, frame->len, frame->timeoutInMs, frame->header, frame->headerLen) == ERR_BUSY_TIMEOUT ) 
+  {
+    TxStatus = ERR_BUSY_TIMEOUT;
+    FinishTx();
+  }
+}
+
+
+// loads and starts a frame, with an optional header sent in front of the payload, returns ERR_BUSY_TIMEOUT with the duty
+// cycle reservation undone if the chip did not respond
+uint8_t SX126x::StartTx(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, const uint8_t *header, uint8_t headerLen)
+{
+  uint32_t busyTimeouts = BusyTimeouts;
+  len += headerLen;
+
+  // a CAD of ReceiveCad() may still be running
+  if ( ChipMode == SX126X_CHIP_MODE_CAD ) {
+    SetStandby(SX126X_STANDBY_RC);
+  }
+
+  SetPayloadLength(len);
+
+  if ( timeoutInMs == SX126X_TIMEOUT_AUTO ) {
+    timeoutInMs = AutoTimeout(len);
+  }
+
+  // reserve the predicted airtime, SettleDutyCycle() replaces it with the measured one on TX_DONE
+  TxBand = FindDutyCycleBand();
+  TxReservedUs = 0;
+  if ( TxBand != SX126X_NO_BAND ) 
+  {
+    TxReservedUs = GetTimeOnAir(len);
+    DutyCycleBands[TxBand].creditUs -= TxReservedUs;
+  }
+
+  uint8_t rv = WriteBuffer(pData, len - headerLen, header, headerLen);
+
+  // with listen before talk the frame waits in the chip's buffer until a CAD finds the channel free
+  TxTimeoutMs = timeoutInMs;
+  if ( LbtMaxAttempts > 0 && PacketType == SX126X_PACKET_TYPE_LORA ) 
+  {
+    LbtAttempt = 0;
+    LbtCadActive = true;
+    SetCad(SX126X_CAD_GOTO_STDBY, 0);
+  }
+  else 
+  {
+    TxStartMicros = Hal->Micros();
+    SetTx(timeoutInMs);
+  }
+
+  if ( BusyTimeouts != busyTimeouts ) 
+  {
+    LbtCadActive = false;
+    SettleDutyCycle(TxStartMicros);
+    rv = ERR_BUSY_TIMEOUT;
+  }
+
+  return rv;
+}
+
+
+// ends the current frame: chains the next queued frame before running the hooks, or returns to the default mode
+void SX126x::FinishTx(void)
+{
+  uint8_t doneId = TxId;
+  uint8_t fragmentLen = TxFragmentLen;
+  bool arqFrame = ArqTxOnAir;
+  bool ackFrame = ArqTxAckOnAir;
+  bool linkFrame = LinkTxOnAir;
+
+  ArqTxOnAir = false;
+  ArqTxAckOnAir = false;
+  LinkTxOnAir = false;
+  if ( arqFrame ) {
+    ArqFrameSent();
+  }
+  if ( linkFrame ) {
+    LinkFrameSent();
+  }
+
+  // a failed fragment ends its stream, the fragments queued behind it are dropped
+  if ( fragmentLen > 0 && TxStatus != ERR_NONE ) {
+    TxQueueTail = TxQueueHead;
+  }
+
+  // the chip is in standby after TX, so the next frame or the default mode starts on the next channel
+  if ( HopChannels != NULL && (HopMode & SX126X_HOP_AFTER_TX) ) {
+    NextHop();
+  }
+
+  SX126xTxFrame* next = &TxQueue[TxQueueTail % SX126X_TX_QUEUE_DEPTH];
+  if ( TxQueueCount() > 0 && DutyCycleAllows(next->len + next->headerLen) ) {
+    StartQueuedTx();
+  }
+  else if ( !ArqStartNext() ) 
+  {
+    EnterDefaultMode();
+    txActive = false;
+  }
+
+  // reliable frames are reported when they are acknowledged, acknowledgements and link frames not at all
+  if ( arqFrame || ackFrame || linkFrame ) {
+    return;
+  }
+
+  if ( fragmentLen > 0 ) 
+  {
+    StreamFragmentSent(fragmentLen);
+    return;
+  }
+
+  if ( __txDoneHook != nullptr ) {
+    __txDoneHook(TxStatus);
+  }
+  if ( __txQueueDoneHook != nullptr ) {
+    __txQueueDoneHook(TxStatus, doneId);
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Binary exponential backoff after a CAD found the channel busy: waits a random number of slots between 1 and
+//  2^attempt, with the exponent capped at SX126X_LBT_MAX_BACKOFF_EXPONENT. The chip waits in STDBY_RC and Service()
+//  starts the next CAD once the backoff has passed. Without a configured slot time a slot is the frame's time on air,
+//  about as long as the transmission that was heard is likely to last.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::BackOff(void)
+{
+  uint8_t exponent = (LbtAttempt < SX126X_LBT_MAX_BACKOFF_EXPONENT) ? LbtAttempt : SX126X_LBT_MAX_BACKOFF_EXPONENT;
+  uint32_t slots = 1 + Random() % ((uint32_t)1 << exponent);
+  uint32_t slotUs = (LbtSlotUs != 0) ? LbtSlotUs : GetTimeOnAir(GetPayloadLength());
+
+  LbtRetryMicros = Hal->Micros() + slots * slotUs;
+  LbtBackoff = true;
+}
+
+
+// xorshift32, seeded from the clock on first use so radios that boot together do not back off in lockstep
+uint32_t SX126x::Random(void)
+{
+  if ( RandomState == 0 ) {
+    RandomState = (Hal->Micros() ^ (RfFrequency << 8) ^ (uint32_t)(uintptr_t)this) | 1;
+  }
+
+  RandomState ^= RandomState << 13;
+  RandomState ^= RandomState >> 17;
+  RandomState ^= RandomState << 5;
+  return RandomState;
+}
+
+
+uint8_t SX126x::ReceiveMode(uint32_t timeoutInMs)
+{
+  uint8_t rv = ERR_NONE;
+
+  if ( txActive == true || ConfigPending() )
+  {
     rv = ERR_DEVICE_BUSY;
   }
-  else 
-  {
-    PacketParams[3] = len;
-	  SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, 6);
-
-    rv = WriteBuffer(pData, len);
-	  SetTx(timeoutInMs);
-
-    txActive = true;
+  else
+  {
+    if ( timeoutInMs == SX126X_TIMEOUT_AUTO ) {
+      timeoutInMs = AutoTimeout(GetPayloadLength());
+    }
+
+    // the shadowed mode is only SX126X_STATUS_MODE_RX while a continuous RX is running
+    uint32_t busyTimeouts = BusyTimeouts;
+    if ( ChipMode != SX126X_STATUS_MODE_RX ) {
+      SetRx(timeoutInMs);
+    }
+    if ( BusyTimeouts != busyTimeouts ) {
+      rv = ERR_BUSY_TIMEOUT;
+    }
+  }
+
+  return rv;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Time on air of a packet with the current modulation and packet parameters, using the formula of the SX1261/2
+//  datasheet (section 6.1.4). The LoRa symbol count is kept in quarter symbols so the 4.25/6.25 symbol sync word and
+//  preamble tail stay exact in integer math:
+//
+//    SF5/6:  Npreamble + 6.25 + 8 + ceil(max(8*PL + CRC*16 - 4*SF + H*20, 0) / (4*SF)) * (CR + 4)
+//    SF7+:   Npreamble + 4.25 + 8 + ceil(max(8*PL + CRC*16 - 4*SF + 8 + H*20, 0) / (4*(SF - 2*LDRO))) * (CR + 4)
+//
+//  H is 1 with an explicit header. ToA = Nsymbol * 2^SF / BW.
+//
+//  GFSK sends preamble, sync word, the length byte of variable length packets, the address byte when address filtering
+//  is on, the payload and the CRC, one bit every 32 * Fxtal / bit rate word = word / 1024 us.
+//
+//  Parameters:
+//  payloadLen - payload length in bytes
+//
+//  Return value:
+//  time on air in us, 0 if the modulation is not configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint32_t SX126x::GetTimeOnAir(uint16_t payloadLen)
+{
+  if ( PacketType == SX126X_PACKET_TYPE_GFSK )
+  {
+    uint32_t bitRateWord = ((uint32_t)ModulationParams[0] << 16) | ((uint32_t)ModulationParams[1] << 8) | ModulationParams[2];
+    uint32_t bits = (((uint16_t)PacketParams[0] << 8) | PacketParams[1]) + PacketParams[3] + 8 * (uint32_t)payloadLen;
+    if ( PacketParams[5] == SX126X_GFSK_PACKET_VARIABLE ) {
+      bits += 8;
+    }
+    if ( PacketParams[4] != SX126X_GFSK_ADDRESS_FILT_OFF ) {
+      bits += 8;
+    }
+    if ( PacketParams[7] == SX126X_GFSK_CRC_2_BYTE || PacketParams[7] == SX126X_GFSK_CRC_2_BYTE_INV ) {
+      bits += 16;
+    }
+    else if ( PacketParams[7] != SX126X_GFSK_CRC_OFF ) {
+      bits += 8;
+    }
+    return (uint32_t)((uint64_t)bits * bitRateWord / 1024);
+  }
+
+  if ( PacketType != SX126X_PACKET_TYPE_LORA ) {
+    return 0;
+  }
+
+  uint8_t  sf        = ModulationParams[0];
+  uint32_t bandwidth = SX126xLoRaBandwidthHz(ModulationParams[1]);
+  uint8_t  cr        = ModulationParams[2];
+  bool     ldro      = ModulationParams[3] == SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_ON;
+  uint16_t preamble  = ((uint16_t)PacketParams[0] << 8) | PacketParams[1];
+  bool     explicitHeader = PacketParams[2] == SX126X_LORA_HEADER_EXPLICIT;
+  bool     crcOn     = PacketParams[4] == SX126X_LORA_CRC_ON;
+
+  if ( sf < 5 || sf > 12 || bandwidth == 0 ) {
+    return 0;
+  }
+
+  int32_t bits = 8 * (int32_t)payloadLen + (crcOn ? 16 : 0) - 4 * sf + (explicitHeader ? 20 : 0);
+  uint8_t bitsPerBlock = 4 * sf;
+  uint32_t quarterSymbols = 4 * (uint32_t)preamble + 32;
+  if ( sf < 7 )
+  {
+    quarterSymbols += 25;
+  }
+  else
+  {
+    quarterSymbols += 17;
+    bits += 8;
+    if ( ldro ) {
+      bitsPerBlock = 4 * (sf - 2);
+    }
+  }
+
+  if ( bits > 0 ) {
+    quarterSymbols += 4 * ((bits + bitsPerBlock - 1) / bitsPerBlock) * (cr + 4);
+  }
+
+  return (uint32_t)(((uint64_t)quarterSymbols << sf) * 250000 / bandwidth);
+}
+
+
+// the payload length lives at a different index of the packet parameters in LoRa and GFSK
+uint8_t SX126x::GetPayloadLength(void)
+{
+  return (PacketType == SX126X_PACKET_TYPE_GFSK) ? PacketParams[SX126X_GFSK_PAYLOAD_LENGTH_PARAM] : PacketParams[SX126X_LORA_PAYLOAD_LENGTH_PARAM];
+}
+
+
+void SX126x::SetPayloadLength(uint8_t len)
+{
+  if ( PacketType == SX126X_PACKET_TYPE_GFSK ) 
+  {
+    PacketParams[SX126X_GFSK_PAYLOAD_LENGTH_PARAM] = len;
+    SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, SX126X_GFSK_PACKET_PARAMS);
+  }
+  else 
+  {
+    PacketParams[SX126X_LORA_PAYLOAD_LENGTH_PARAM] = len;
+    SPIwriteCommand(SX126X_CMD_SET_PACKET_PARAMS, PacketParams, SX126X_LORA_PACKET_PARAMS);
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Timeout used for SX126X_TIMEOUT_AUTO: the time on air of the packet plus 1/16 for clock tolerance and
+//  SX126X_TIMEOUT_AUTO_MARGIN_MS for the PA ramp and mode switches, rounded up to whole ms.
+//
+//  Return value:
+//  timeout in ms, 0 (no timeout) if the time on air is unknown
+//----------------------------------------------------------------------------------------------------------------------------
+uint32_t SX126x::AutoTimeout(uint16_t payloadLen)
+{
+  uint32_t toa = GetTimeOnAir(payloadLen);
+  if ( toa == 0 ) {
+    return 0;
+  }
+
+  return (toa + toa / 16 + 999) / 1000 + SX126X_TIMEOUT_AUTO_MARGIN_MS;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Configures the airtime budget of a regulatory sub-band (e.g. the 1% and 10% bands of EU868). Each band is a token
+//  bucket: it earns 1 ms of airtime per divisor ms of wall time, up to maxBurstInMs, and every transmission on a
+//  frequency inside [minHz, maxHz] spends its actual airtime, measured from SetTx to the TX_DONE interrupt. SendAsync()
+//  and Send() refuse a frame the band can not pay for with ERR_DUTY_CYCLE, SendQueued() keeps it queued until it can.
+//  Frequencies outside all bands are not limited. The bucket starts full.
+//
+//  Parameters:
+//  index        - 0 .. SX126X_DUTY_CYCLE_BANDS - 1
+//  minHz, maxHz - frequency range of the sub-band
+//  divisor      - 100 for 1%, 10 for 10%, 1000 for 0.1%; 0 removes the band
+//  maxBurstInMs - airtime that can be saved up, 36000 is 1% of one hour
+//
+//  Return value:
+//  ERR_NONE or ERR_UNKNOWN for an invalid index
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::SetDutyCycleBand(uint8_t index, uint32_t minHz, uint32_t maxHz, uint16_t divisor, uint32_t maxBurstInMs)
+{
+  if ( index >= SX126X_DUTY_CYCLE_BANDS ) {
+    return ERR_UNKNOWN;
+  }
+
+  SX126xDutyCycleBand* band = &DutyCycleBands[index];
+  band->minHz       = minHz;
+  band->maxHz       = maxHz;
+  band->divisor     = divisor;
+  band->maxCreditUs = maxBurstInMs * 1000;
+  band->creditUs    = band->maxCreditUs;
+  band->lastMs      = Hal->Millis();
+
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Predicts when a frame of the given length may be sent on the current frequency.
+//
+//  Return value:
+//  ms until the sub-band has earned enough airtime, 0 if the frame can go now, 0xFFFFFFFF if the frame is longer than
+//  the band's burst allowance and will never fit
+//----------------------------------------------------------------------------------------------------------------------------
+uint32_t SX126x::GetTxDelay(uint16_t len)
+{
+  uint8_t index = FindDutyCycleBand();
+  if ( index == SX126X_NO_BAND ) {
+    return 0;
+  }
+
+  SX126xDutyCycleBand* band = &DutyCycleBands[index];
+  RefillDutyCycleBand(band);
+
+  int32_t need = GetTimeOnAir(len);
+  if ( (uint32_t)need > band->maxCreditUs ) {
+    return 0xFFFFFFFF;
+  }
+  if ( band->creditUs >= need ) {
+    return 0;
+  }
+
+  // credit comes in steps of 1 ms every divisor ms, part of the current step has already passed
+  uint32_t steps = ((uint32_t)(need - band->creditUs) + 999) / 1000;
+  uint32_t elapsed = Hal->Millis() - band->lastMs;
+  uint32_t delay = steps * band->divisor;
+  return (delay > elapsed) ? delay - elapsed : 0;
+}
+
+
+uint8_t SX126x::FindDutyCycleBand(void)
+{
+  for ( uint8_t i = 0; i < SX126X_DUTY_CYCLE_BANDS; i++ )
+  {
+    SX126xDutyCycleBand* band = &DutyCycleBands[i];
+    if ( band->divisor != 0 && RfFrequency >= band->minHz && RfFrequency <= band->maxHz ) {
+      return i;
+    }
+  }
+  return SX126X_NO_BAND;
+}
+
+
+// adds the airtime earned since the last refill, lastMs only moves by whole steps so no fraction of a step is lost
+void SX126x::RefillDutyCycleBand(SX126xDutyCycleBand* band)
+{
+  uint32_t now = Hal->Millis();
+  uint32_t steps = (now - band->lastMs) / band->divisor;
+
+  uint32_t missing = band->maxCreditUs - band->creditUs;
+
+  band->lastMs += steps * band->divisor;
+  if ( steps >= (missing + 999) / 1000 ) 
+  {
+    band->creditUs = band->maxCreditUs;
+    band->lastMs = now;
+  }
+  else {
+    band->creditUs += steps * 1000;
+  }
+}
+
+
+bool SX126x::DutyCycleAllows(uint16_t len)
+{
+  uint8_t index = FindDutyCycleBand();
+  if ( index == SX126X_NO_BAND ) {
+    return true;
+  }
+
+  SX126xDutyCycleBand* band = &DutyCycleBands[index];
+  RefillDutyCycleBand(band);
+  return band->creditUs >= (int32_t)GetTimeOnAir(len);
+}
+
+
+// replaces the airtime reserved by StartTx() with the time from SetTx to the TX_DONE/TIMEOUT interrupt
+void SX126x::SettleDutyCycle(uint32_t doneMicros)
+{
+  if ( TxBand == SX126X_NO_BAND ) {
+    return;
+  }
+
+  uint32_t actual = doneMicros - TxStartMicros;
+  DutyCycleBands[TxBand].creditUs += (int32_t)TxReservedUs - (int32_t)actual;
+  TxBand = SX126X_NO_BAND;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Number of SPI commands sent to the chip and of commands skipped because the shadow state showed they would not change
+//  anything (repeated configuration, mode commands for the mode the chip is already in, clearing IRQs that are not set).
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::GetCommandCounts(uint32_t *issued, uint32_t *suppressed)
+{
+  *issued = CmdIssued;
+  *suppressed = CmdSuppressed;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Listens with the chip's RX duty cycle: the chip alternates short RX windows with sleep on its own RTC, without the
+//  host, and stays in RX when a window detects a preamble. Received packets are reported through Dio1Interrupt() and
+//  the RX hook or ring as usual. RX duty cycle becomes the default mode, so the radio goes back to sniffing after every
+//  received or transmitted packet.
+//
+//  The periods come from the preamble length and the symbol time. A window lasts SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS
+//  symbols. The sleep between windows is short enough that a window always falls inside a preamble with that many
+//  symbols left, even when the preamble starts just too late for the previous window:
+//
+//    sleep = (preamble - 2 * SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS) * Tsymbol - SX126X_RX_DUTY_CYCLE_WAKE_US
+//
+//  Parameters:
+//  preambleLength - preamble length of the transmitters in symbols, 0 to use the configured one. Transmitters must use
+//                   a long preamble for sniffing to save power.
+//
+//  Return value:
+//  ERR_NONE, ERR_DEVICE_BUSY during a transmission or configuration sequence, ERR_WRONG_MODEM if not in LoRa mode,
+//  ERR_UNSUPPORTED_MODE if the preamble is too short to sniff, ERR_BUSY_TIMEOUT if the chip did not respond
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::ReceiveDutyCycle(uint16_t preambleLength)
+{
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  uint16_t savedPreamble = SniffPreamble;
+  SniffPreamble = preambleLength;
+
+  uint8_t rv = SetRxDutyCycle(preambleLength);
+  if ( rv == ERR_NONE ) {
+    DefaultMode = SX126X_DEFAULT_MODE_RX_DUTY_CYCLE;
+  }
+  else {
+    SniffPreamble = savedPreamble;
+  }
+
+  return rv;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Listens with channel activity detection: the chip runs a CAD, which takes a few symbols, and only switches to RX when
+//  it detects a LoRa preamble. Without activity it goes back to STDBY_RC and, after intervalInMs in warm sleep, runs the
+//  next CAD. Received packets are reported through Dio1Interrupt() and the RX hook or ring as usual. CAD receive becomes
+//  the default mode, so the radio returns to it after every received or transmitted packet.
+//
+//  The interval must be shorter than the transmitters' preamble minus the CAD time or packets are missed. With an
+//  interval, Service() has to be called from loop() to start the CADs.
+//
+//  Parameters:
+//  intervalInMs - sleep between two CADs, 0 to run them back to back
+//
+//  Return value:
+//  ERR_NONE, ERR_DEVICE_BUSY during a transmission or configuration sequence or ERR_WRONG_MODEM if not in LoRa mode
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::ReceiveCad(uint32_t intervalInMs)
+{
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+  if ( PacketType != SX126X_PACKET_TYPE_LORA ) {
+    return ERR_WRONG_MODEM;
+  }
+
+  DefaultMode = SX126X_DEFAULT_MODE_CAD_RX;
+  CadRxIntervalMs = intervalInMs;
+  CadRxPending = false;
+  SetCad(SX126X_CAD_GOTO_RX, CadRxTimeout());
+
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Sets the detection thresholds used by listen before talk and ReceiveCad(). More symbols and a lower peak make CAD
+//  more sensitive at the cost of CAD time and false detections; the defaults follow Semtech's recommendations.
+//
+//  Parameters:
+//  symbolNum - SX126X_CAD_ON_1_SYMB to SX126X_CAD_ON_16_SYMB
+//  detPeak   - correlation peak that counts as activity, 0 to follow the spreading factor (SX126xCadDetPeak())
+//  detMin    - minimum correlation for a detection
+//
+//  Return value:
+//  ERR_NONE or ERR_UNKNOWN for an invalid symbol number
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::SetCadThresholds(uint8_t symbolNum, uint8_t detPeak, uint8_t detMin)
+{
+  if ( symbolNum > SX126X_CAD_ON_16_SYMB ) {
+    return ERR_UNKNOWN;
+  }
+
+  CadSymbolNum = symbolNum;
+  CadDetPeak = detPeak;
+  CadDetMin = detMin;
+
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Turns listen before talk on for every frame sent with SendAsync(), Send() and SendQueued(). The payload is loaded and
+//  a CAD checks the channel first; the frame goes on air only when the CAD finds no LoRa activity. After a detection the
+//  driver backs off (see BackOff()) and tries again, up to maxAttempts CADs, then fails the frame with ERR_CHANNEL_BUSY.
+//  Backoffs are timed by Service(), which Send() calls itself; with SendAsync() or SendQueued() call it from loop().
+//
+//  Parameters:
+//  maxAttempts     - CADs per frame, 0 turns listen before talk off
+//  backoffSlotInUs - backoff slot, 0 to use the frame's time on air
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::SetListenBeforeTalk(uint8_t maxAttempts, uint32_t backoffSlotInUs)
+{
+  LbtMaxAttempts = maxAttempts;
+  LbtSlotUs = backoffSlotInUs;
+}
+
+
+// RSSI and SNR of the last received packet in whole dB, see GetPacketStatus() for the full resolution
+void SX126x::ReceiveStatus(int8_t *rssiPacket, int8_t *snrPacket)
+{
+  SX126xPacketStatus status;
+  GetPacketStatus(&status);
+  *rssiPacket = SX126xQuarterDbToDb(status.rssi);
+  *snrPacket = SX126xQuarterDbToDb(status.snr);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Reads the link quality of the last received packet with a single GetPacketStatus command. The chip reports RSSI
+//  levels as -level/2 dBm and the LoRa SNR as a signed number of 1/4 dB, both are converted to 1/4 dB without rounding.
+//  Packets delivered through the RX ring or the RX hook already carry it in SX126xRxPacket::packetStatus.
+//
+//  Parameters:
+//  status - filled with the packet status of the current modem
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::GetPacketStatus(SX126xPacketStatus *status)
+{
+  uint8_t buf[3] = { 0, 0, 0 };
+
+  SPIreadCommand(SX126X_CMD_GET_PACKET_STATUS, buf, 3);
+
+  // GFSK reports RX status, RSSI at sync and average RSSI, and no SNR
+  if ( PacketType == SX126X_PACKET_TYPE_GFSK ) 
+  {
+    status->rxStatus   = buf[0];
+    status->signalRssi = -2 * (int16_t)buf[1];
+    status->rssi       = -2 * (int16_t)buf[2];
+    status->snr        = 0;
+  }
+  else 
+  {
+    status->rxStatus   = 0;
+    status->rssi       = -2 * (int16_t)buf[0];
+    status->snr        = (int8_t)buf[1];
+    status->signalRssi = -2 * (int16_t)buf[2];
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Packet counters the chip keeps since the last ResetChipStats(), a reset or a cold sleep. They cost no SPI traffic
+//  while receiving; read them e.g. once per reporting period.
+//
+//  Parameters:
+//  received     - packets received, errors included
+//  crcErrors    - packets received with a wrong CRC
+//  headerErrors - LoRa header errors; GFSK packets with a length error
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::GetChipStats(uint16_t *received, uint16_t *crcErrors, uint16_t *headerErrors)
+{
+  uint8_t buf[6] = { 0, 0, 0, 0, 0, 0 };
+
+  SPIreadCommand(SX126X_CMD_GET_STATS, buf, 6);
+  *received = (buf[0] << 8) | buf[1];
+  *crcErrors = (buf[2] << 8) | buf[3];
+  *headerErrors = (buf[4] << 8) | buf[5];
+}
+
+
+void SX126x::ResetChipStats(void)
+{
+  uint8_t buf[6] = { 0, 0, 0, 0, 0, 0 };
+  SPIwriteCommand(SX126X_CMD_RESET_STATS, buf, 6);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  BUSY stays high while the chip sleeps, so waking it can not go through SPItransfer(). The falling edge of NSS wakes
+//  the chip; the GetStatus command clocked with it is lost and BUSY goes low once the chip is in STDBY_RC. An edge that
+//  comes while the chip is still entering sleep is lost as well, so a wake right after SetSleep waits for
+//  SX126X_SLEEP_SETTLE_US to pass first.
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::Wakeup(void)
+{
+  if ( ChipMode == SX126X_CHIP_MODE_SLEEP ) 
+  {
+    uint32_t asleepUs = Hal->Micros() - SleepStartMicros;
+    if ( asleepUs < SX126X_SLEEP_SETTLE_US ) {
+      Hal->DelayMicroseconds(SX126X_SLEEP_SETTLE_US - asleepUs);
+    }
+  }
+
+  Hal->SpiBegin();
+  Hal->SpiTransfer(SX126X_CMD_GET_STATUS);
+  Hal->SpiTransfer(SX126X_CMD_NOP);
+  Hal->SpiEnd();
+#if SX126X_STATS
+  Stats.spiBytes += 2;
+#endif
+  if ( WaitOnBusy() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+
+  if ( ChipMode == SX126X_CHIP_MODE_SLEEP ) {
+    SleepTotalMs += Hal->Millis() - SleepStartMs;
+  }
+  ChipMode = SX126X_STATUS_MODE_STDBY_RC;
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Sends the chip to sleep. The chip only accepts SetSleep from standby. In warm sleep it keeps its configuration, in cold
+//  sleep everything is lost but the shadow is kept and marked stale, so RestoreShadow() can replay it on wake.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::SetSleep(uint8_t sleepConfig)
+{
+  SetStandby(SX126X_STANDBY_RC);
+
+  uint8_t data = sleepConfig;
+  if ( SPIwriteCommand(SX126X_CMD_SET_SLEEP, &data, 1, false) != ERR_NONE ) 
+  {
+    ChipMode = SX126X_CHIP_MODE_UNKNOWN;
+    return;
+  }
+  ChipMode = SX126X_CHIP_MODE_SLEEP;
+  SleepStartMs = Hal->Millis();
+  SleepStartMicros = Hal->Micros();
+
+  if ( !(sleepConfig & SX126X_SLEEP_START_WARM) ) {
+    ShadowStale = true;
+  }
+}
+
+
+// called before every SPI access: wakes a sleeping chip and, after a cold sleep, rewrites its configuration
+uint8_t SX126x::WakeIfAsleep(void)
+{
+  if ( ChipMode != SX126X_CHIP_MODE_SLEEP ) {
+    return ERR_NONE;
+  }
+
+  if ( Wakeup() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+  if ( ShadowStale ) {
+    RestoreShadow();
+  }
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Replays every configuration command recorded in the shadow, in the order of SX126X_SHADOWED_COMMANDS, to bring a chip
+//  that woke from cold sleep back to the configuration it had. The chip is recalibrated once the oscillator and
+//  regulator are set up, as ModuleConfig() does.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::RestoreShadow(void)
+{
+  ShadowStale = false;
+  IrqMaybeSet = SX126X_IRQ_ALL;
+
+  for ( uint8_t i = 0; i < SX126X_SHADOW_SLOTS; i++ )
+  {
+    if ( i == SX126X_SHADOW_CALIBRATE_AFTER ) {
+      Calibrate(SX126X_CALIBRATE_ALL_BLOCKS);
+    }
+
+    uint8_t* shadow = ShadowParams[i];
+    if ( shadow[0] <= SX126X_SHADOW_MAX_PARAMS ) {
+      SPItransfer(SX126X_SHADOWED_COMMANDS[i], true, &shadow[1], NULL, shadow[0], true);
+    }
+  }
+
+  if ( PacketType == SX126X_PACKET_TYPE_GFSK ) {
+    WriteGfskRegisters();
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Total time the radio has spent in sleep since it was created, including the current sleep.
+//
+//  Return value:
+//  time asleep in ms
+//----------------------------------------------------------------------------------------------------------------------------
+uint32_t SX126x::GetSleepTime(void)
+{
+  if ( ChipMode == SX126X_CHIP_MODE_SLEEP ) {
+    return SleepTotalMs + (Hal->Millis() - SleepStartMs);
+  }
+  return SleepTotalMs;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Effective SPI throughput of the payload transfers done by ReadBuffer() and WriteBuffer() since the last call, in bytes
+//  per microsecond. Use it to compare the block transfer path of a backend against the byte loop
+//  (SX126X_SPI_BYTE_LOOP) on a given target.
+//
+//  Return value:
+//  bytes/us, 0 when no payload has been moved yet
+//----------------------------------------------------------------------------------------------------------------------------
+float SX126x::GetSpiThroughput(void)
+{
+  float rv = 0;
+
+  if ( SpiBlockMicros > 0 ) {
+    rv = (float)SpiBlockBytes / (float)SpiBlockMicros;
+  }
+  SpiBlockBytes = 0;
+  SpiBlockMicros = 0;
+
+  return rv;
+}
+
+
+void SX126x::setTxDoneHook(void (*txHook)(uint8_t txStatus)) {
+  __txDoneHook = txHook;
+}
+
+
+// TX done hook that also receives the ID of the completed frame, see SendQueued()
+void SX126x::setTxDoneHook(void (*txHook)(uint8_t txStatus, uint8_t queueId)) {
+  __txQueueDoneHook = txHook;
+}
+
+
+void SX126x::setRxDoneHook(void (*rxHook)(uint8_t rxStatus, uint8_t *pdata, uint16_t len)) {
+  __rxDoneHook = rxHook;
+}
+
+
+// RX done hook that gets the whole ring slot, with RSSI, signal RSSI and SNR; the slot is reused after the hook returns
+void SX126x::setRxDoneHook(void (*rxHook)(uint8_t rxStatus, SX126xRxPacket *packet)) {
+  __rxPacketHook = rxHook;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  DIO1 interrupt entry. In SX126X_SERVICE_MODE_ISR (default) the radio is serviced right here. In
+//  SX126X_SERVICE_MODE_DEFERRED the interrupt only records the event and its timestamp and calls the service hook, which
+//  is expected to get Service() called outside of interrupt context: from loop(), from a RTOS task it notifies or from a
+//  host thread. That keeps all SPI traffic and BUSY waits out of the interrupt.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::Dio1Interrupt() 
+{
+  EventTimestamp = Hal->Micros();
+
+  if ( ServiceMode == SX126X_SERVICE_MODE_DEFERRED ) 
+  {
+    EventPending = true;
+    if ( __serviceHook != nullptr ) {
+      __serviceHook(this);
+    }
+  }
+  else {
+    ServiceIrq();
+  }
+
+#if SX126X_STATS
+  uint32_t isrUs = Hal->Micros() - EventTimestamp;
+  Stats.isrCount++;
+  Stats.isrTimeUs += isrUs;
+  if ( isrUs > Stats.isrMaxUs ) {
+    Stats.isrMaxUs = isrUs;
+  }
+#endif
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Advances a ModuleConfigAsync() or LoRaBeginAsync() sequence, handles the DIO1 event recorded by Dio1Interrupt() in
+//  SX126X_SERVICE_MODE_DEFERRED, starts queued frames that were held back by the duty cycle budget and runs the timers of
+//  listen before talk backoff, ReliableSend() acknowledgements, link adaptation and ReceiveCad() intervals. Does nothing when
+//  none of them is pending, so it is cheap to call from every pass of loop().
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::Service(void)
+{
+  if ( ConfigPending() ) 
+  {
+    RunSequence(false);
+    if ( ConfigPending() ) {
+      return;
+    }
+  }
+
+  if ( EventPending ) 
+  {
+    EventPending = false;
+    ServiceIrq();
+  }
+
+  // a stream source that had no data ready is asked again
+  if ( StreamTxActive && !txActive ) {
+    StreamFill();
+  }
+
+  SX126xTxFrame* next = &TxQueue[TxQueueTail % SX126X_TX_QUEUE_DEPTH];
+  if ( !txActive && TxQueueCount() > 0 && DutyCycleAllows(next->len + next->headerLen) ) 
+  {
+    txActive = true;
+    StartQueuedTx();
+  }
+
+  // no acknowledgement for the last burst, ask again
+  if ( ArqAckWait && (int32_t)(Hal->Micros() - ArqAckDeadline) >= 0 ) 
+  {
+    ArqAckWait = false;
+    ArqRetransmit(false);
+  }
+
+  // link adaptation: frames that had to wait for the radio, switch timeouts and the fallback after a silence
+  if ( LinkTxPending != SX126X_LINK_NONE && !txActive ) 
+  {
+    uint8_t type = LinkTxPending;
+    LinkTxPending = SX126X_LINK_NONE;
+    LinkSend(type);
+  }
+  if ( LinkTimerArmed && !txActive && (int32_t)(Hal->Micros() - LinkDeadline) >= 0 ) {
+    LinkTimeout();
+  }
+  if ( LinkRates != NULL && SX126X_LINK_SILENCE_MS != 0 && LinkState == SX126X_LINK_STATE_IDLE && !txActive &&
+       Hal->Millis() - LinkHeardMs >= SX126X_LINK_SILENCE_MS ) 
+  {
+    LinkHeardMs = Hal->Millis();
+    if ( LinkRate != LinkRateCount - 1 || LinkPower != LinkMaxPower ) 
+    {
+      ApplyLinkRate(LinkRateCount - 1);
+      LinkPower = LinkMaxPower;
+      SetTxPower(LinkPower);
+      LinkLocalValid = false;
+      LinkPeerValid = false;
+      EndLinkSwitch(ERR_RX_TIMEOUT);
+    }
+  }
+
+  // reliable frames that were held back by the duty cycle budget or sent while the radio was busy
+  if ( !txActive && !ArqAckWait && ArqTxBase != ArqTxNextSeq ) 
+  {
+    txActive = true;
+    if ( !ArqStartNext() ) {
+      txActive = false;
+    }
+  }
+
+  if ( LbtBackoff && (int32_t)(Hal->Micros() - LbtRetryMicros) >= 0 ) 
+  {
+    LbtBackoff = false;
+    LbtCadActive = true;
+    SetCad(SX126X_CAD_GOTO_STDBY, 0);
+  }
+
+  if ( CadRxPending && !txActive && ChipMode == SX126X_CHIP_MODE_SLEEP && (int32_t)(Hal->Millis() - CadRxDueMs) >= 0 ) 
+  {
+    CadRxPending = false;
+    SetCad(SX126X_CAD_GOTO_RX, CadRxTimeout());
+  }
+}
+
+
+void SX126x::SetServiceMode(uint8_t mode)
+{
+  ServiceMode = mode;
+}
+
+
+void SX126x::setServiceHook(void (*serviceHook)(SX126x* radio))
+{
+  __serviceHook = serviceHook;
+}
+
+
+// micros() timestamp of the last DIO1 edge
+uint32_t SX126x::GetEventTimestamp(void)
+{
+  return EventTimestamp;
+}
+
+
+void SX126x::ServiceIrq(void)
+{
+  uint16_t irq = GetIrqStatus();
+  if ( irq == SX126X_IRQ_NONE ) {
+    return;
+  }
+
+  // CAD ends in STDBY_RC, or in RX with exit mode SX126X_CAD_GOTO_RX when it detected activity
+  if ( irq & SX126X_IRQ_CAD_DONE ) {
+    ChipMode = (!LbtCadActive && (irq & SX126X_IRQ_CAD_DETECTED)) ? SX126X_CHIP_MODE_UNKNOWN : SX126X_STATUS_MODE_STDBY_RC;
+  }
+
+  // TX and any RX but the continuous one fall back to STDBY_RC when they end
+  if ( ChipMode != SX126X_STATUS_MODE_RX && (irq & (SX126X_IRQ_TX_DONE | SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT)) ) {
+    ChipMode = SX126X_STATUS_MODE_STDBY_RC;
+  }
+
+  // clear what we are about to handle so DIO1 falls and the next IRQ produces a new edge
+  ClearIrqStatus(irq);
+
+#if SX126X_STATS
+  if ( irq & SX126X_IRQ_HEADER_ERR ) {
+    Stats.headerErrors++;
+  }
+#endif
+
+  if( txActive ) 
+  {
+    if ( LbtCadActive && (irq & SX126X_IRQ_CAD_DONE) ) 
+    {
+      LbtCadActive = false;
+      if ( !(irq & SX126X_IRQ_CAD_DETECTED) ) 
+      {
+        TxStartMicros = Hal->Micros();
+        SetTx(TxTimeoutMs);
+      }
+      else if ( ++LbtAttempt < LbtMaxAttempts ) {
+        BackOff();
+      }
+      else 
+      {
+        // nothing went on air, give the reserved airtime back
+        TxStatus = ERR_CHANNEL_BUSY;
+        SettleDutyCycle(TxStartMicros);
+        FinishTx();
+      }
+    }
+    else if ( irq & (SX126X_IRQ_TX_DONE | SX126X_IRQ_TIMEOUT) ) 
+    {
+      TxStatus = (irq & SX126X_IRQ_TIMEOUT) ? ERR_TX_TIMEOUT : ERR_NONE;
+#if SX126X_STATS
+      if ( TxStatus == ERR_NONE ) {
+        Stats.txDone++;
+      }
+      else {
+        Stats.txTimeouts++;
+      }
+#endif
+      SettleDutyCycle(EventTimestamp);
+      FinishTx();
+    }
+  }
+  else if ( irq & SX126X_IRQ_RX_DONE ) 
+  {
+#if SX126X_STATS
+    Stats.rxDone++;
+    if ( irq & SX126X_IRQ_CRC_ERR ) {
+      Stats.crcErrors++;
+    }
+#endif
+
+    // While one of the driver's own protocols runs, the first SX126X_RX_PEEK_SIZE bytes are read once and their first byte
+    // picks the protocol. Fragments of a stream go straight into the StreamReceive() buffer and link adaptation frames end
+    // here. Frames of ReliableSend() are acknowledged and continue without their header, acknowledgements and repeated frames
+    // end here. Any other frame is an application frame; with protocol framing its SX126X_ESCAPE_MARKER is taken off. With a
+    // RX hook it is read into RxHookPacket and handed to the hook, whatever is left in the ring. Without one it fills the
+    // slot at the head of the ring and stays there until the application releases it; when the ring is full the frame is
+    // dropped.
+    bool hooked = (__rxPacketHook != nullptr || __rxDoneHook != nullptr);
+    uint8_t len = 0;
+    uint8_t offset = 0;
+    GetRxBufferStatus(&len, &offset);
+    uint8_t start = offset;
+
+    uint8_t head[SX126X_RX_PEEK_SIZE];
+    uint8_t headLen = 0;
+    if ( !(irq & SX126X_IRQ_CRC_ERR) && (StreamRxBuffer != NULL || LinkRates != NULL || ArqRxEnabled || ArqTxSession != 0) ) 
+    {
+      headLen = (len < SX126X_RX_PEEK_SIZE) ? len : SX126X_RX_PEEK_SIZE;
+      if ( ReadBufferAt(offset, head, headLen) != ERR_NONE ) {
+        headLen = 0;
+      }
+    }
+    uint8_t marker = (headLen > 0) ? head[0] : 0;
+
+    if ( LinkRates != NULL && !(irq & SX126X_IRQ_CRC_ERR) ) {
+      LinkHeardMs = Hal->Millis();
+    }
+
+    if ( marker == SX126X_STREAM_MARKER && StreamRxBuffer != NULL && ReceiveFragment(head, len, offset) ) {
+      // consumed by the stream
+    }
+    else if ( marker == SX126X_LINK_MARKER && ReceiveLink(head, len) ) {
+      // consumed by link adaptation
+    }
+    else if ( (marker == SX126X_ARQ_DATA_MARKER || marker == SX126X_ARQ_ACK_MARKER) && ReceiveReliable(head, &len, &offset) ) {
+      // consumed by the reliable link
+    }
+    else if ( hooked || RxRingCount() < SX126X_RX_RING_SLOTS ) 
+    {
+      // the bytes already read with the header are not read again
+      uint8_t skip = offset - start;
+      uint8_t known = (headLen > skip) ? headLen - skip : 0;
+      SX126xRxPacket* slot = hooked ? &RxHookPacket : &RxRing[RxHead % SX126X_RX_RING_SLOTS];
+      memcpy(slot->data, head + skip, known);
+      slot->len = len;
+      slot->irq = irq;
+      slot->status = (known < len) ? ReadBufferAt(offset + known, slot->data + known, len - known) : ERR_NONE;
+      if ( irq & SX126X_IRQ_CRC_ERR ) {
+        slot->status = ERR_CRC_MISMATCH;
+      }
+      else if ( ProtocolFraming && slot->status == ERR_NONE && skip == 0 && len > 0 && slot->data[0] == SX126X_ESCAPE_MARKER ) 
+      {
+        slot->len = len - 1;
+        memmove(slot->data, slot->data + 1, slot->len);
+      }
+      GetPacketStatus(&slot->packetStatus);
+      if ( LinkRates != NULL && slot->status == ERR_NONE ) {
+        LinkMeasure(&slot->packetStatus);
+      }
+
+      if ( __rxPacketHook != nullptr ) {
+        __rxPacketHook(slot->status, slot);
+      }
+      if ( __rxDoneHook != nullptr ) {
+        __rxDoneHook(slot->status, slot->data, slot->len);
+      }
+      if ( !hooked ) {
+        RxHead = (RxHead + 1) % (2 * SX126X_RX_RING_SLOTS);
+      }
+    }
+#if SX126X_STATS
+    else {
+      Stats.rxDropped++;
+    }
+#endif
+
+    // the acknowledgement overwrites the chip's buffer, so it goes out once the frame has been read
+    if ( ArqAckDue ) 
+    {
+      ArqAckDue = false;
+      SendAck();
+    }
+
+    // not while the acknowledgement of the frame is on air, it goes out on the channel the frame came in on
+    if ( HopChannels != NULL && (HopMode & SX126X_HOP_AFTER_RX) && !txActive ) {
+      NextHop();
+    }
+  }
+  else if ( (irq & SX126X_IRQ_TIMEOUT) && DefaultMode != SX126X_DEFAULT_MODE_CAD_RX ) 
+  {
+    // with CAD receive a timeout only means a CAD detection was not followed by a packet
+#if SX126X_STATS
+    Stats.rxTimeouts++;
+#endif
+    if ( __rxPacketHook != nullptr ) {
+      __rxPacketHook(ERR_RX_TIMEOUT, NULL);
+    }
+    if ( __rxDoneHook != nullptr ) {
+      __rxDoneHook(ERR_RX_TIMEOUT, NULL, 0);
+    }
+  }
+
+  // the RX duty cycle and CAD receive end with the packet they caught or with a CAD that found nothing, re-arm them
+  if ( !txActive && ChipMode == SX126X_STATUS_MODE_STDBY_RC &&
+       (DefaultMode == SX126X_DEFAULT_MODE_RX_DUTY_CYCLE || DefaultMode == SX126X_DEFAULT_MODE_CAD_RX) ) {
+    EnterDefaultMode();
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Received packets are kept in a statically sized ring of SX126X_RX_RING_SLOTS slots filled by the DIO1 interrupt when no
+//  RX hook is registered. BorrowRxPacket() returns the oldest packet without copying it; the slot belongs to the caller
+//  until ReleaseRxPacket() hands it back to the interrupt. When the ring is full, newly received packets are dropped.
+//
+//  Return value:
+//  oldest received packet, NULL if the ring is empty
+//----------------------------------------------------------------------------------------------------------------------------
+SX126xRxPacket* SX126x::BorrowRxPacket(void)
+{
+  if ( RxRingCount() == 0 ) {
+    return NULL;
+  }
+  return &RxRing[RxTail % SX126X_RX_RING_SLOTS];
+}
+
+
+void SX126x::ReleaseRxPacket(void)
+{
+  if ( RxRingCount() > 0 ) {
+    RxTail = (RxTail + 1) % (2 * SX126X_RX_RING_SLOTS);
+  }
+}
+
+
+// head and tail run over twice the number of slots so that a full ring can be told apart from an empty one
+uint8_t SX126x::RxRingCount(void)
+{
+  return (RxHead + 2 * SX126X_RX_RING_SLOTS - RxTail) % (2 * SX126X_RX_RING_SLOTS);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Sends a block of any length as a stream of numbered fragments of up to SX126X_STREAM_FRAGMENT_SIZE bytes. Each fragment
+//  goes on air with a SX126X_STREAM_HEADER_SIZE byte header (SX126X_STREAM_MARKER, transfer ID, fragment index, fragment
+//  count and fragment size) that is clocked into the chip in the same SPI transaction as the payload, which is read straight
+//  from data. Fragments go through the TX queue, which is refilled from the TX_DONE of every fragment, so they follow each
+//  other back to back and duty cycle limits and listen before talk apply to each of them.
+//
+//  With data NULL, the payload of each fragment is taken from the source set with setStreamSource(), e.g. a file or
+//  a flash region. The source is called with the offset and length of the fragment and returns a pointer to the bytes,
+//  which must stay valid until the stream TX hook has reported that fragment; up to SX126X_TX_QUEUE_DEPTH fragments
+//  are queued at a time. A source that returns NULL is asked again from Service().
+//
+//  The stream TX hook is called after each fragment with the number of bytes sent. The transfer is over once sent equals
+//  total, or with the first failed fragment, whose status ends the transfer and drops the fragments queued behind it.
+//  No other frame can be sent until then.
+//
+//  Parameters:
+//  data        - block to send, or NULL to use the stream source
+//  len         - length of the block, up to 65535 fragments
+//  timeoutInMs - TX timeout of each fragment, see SendAsync()
+//
+//  Return value:
+//  ERR_NONE, ERR_PACKET_TOO_LONG, ERR_UNKNOWN for an empty block or a missing source, ERR_DEVICE_BUSY while the radio
+//  is sending or being configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::StreamSend(uint8_t *data, uint32_t len, uint32_t timeoutInMs)
+{
+  if ( len == 0 || (data == NULL && __streamSource == nullptr) ) {
+    return ERR_UNKNOWN;
+  }
+  if ( len > (uint32_t)0xFFFF * SX126X_STREAM_FRAGMENT_SIZE ) {
+    return ERR_PACKET_TOO_LONG;
+  }
+  if ( txActive || StreamTxActive || TxQueueCount() > 0 || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  StreamTxData      = data;
+  StreamTxLen       = len;
+  StreamTxSent      = 0;
+  StreamTxTimeoutMs = timeoutInMs;
+  StreamTxCount     = (len + SX126X_STREAM_FRAGMENT_SIZE - 1) / SX126X_STREAM_FRAGMENT_SIZE;
+  StreamTxNext      = 0;
+  StreamTxId++;
+  StreamTxActive    = true;
+
+  // hold the radio while the queue is filled, so the first TX_DONE can not refill it at the same time
+  txActive = true;
+  StreamFill();
+
+  SX126xTxFrame* first = &TxQueue[TxQueueTail % SX126X_TX_QUEUE_DEPTH];
+  if ( TxQueueCount() > 0 && DutyCycleAllows(first->len + first->headerLen) ) {
+    StartQueuedTx();
+  }
+  else {
+    txActive = false;
+  }
+
+  return ERR_NONE;
+}
+
+
+// queues the next fragments of the stream until the TX queue is full
+void SX126x::StreamFill(void)
+{
+  while ( StreamTxActive && StreamTxNext < StreamTxCount && TxQueueCount() < SX126X_TX_QUEUE_DEPTH ) 
+  {
+    uint32_t offset = (uint32_t)StreamTxNext * SX126X_STREAM_FRAGMENT_SIZE;
+    uint16_t len = (StreamTxLen - offset < SX126X_STREAM_FRAGMENT_SIZE) ? StreamTxLen - offset : SX126X_STREAM_FRAGMENT_SIZE;
+    uint8_t* data = (StreamTxData != NULL) ? StreamTxData + offset : __streamSource(offset, len);
+    if ( data == NULL ) {
+      break;
+    }
+
+    uint8_t header[SX126X_STREAM_HEADER_SIZE] = {
+      SX126X_STREAM_MARKER, StreamTxId,
+      (uint8_t)(StreamTxNext >> 8), (uint8_t)StreamTxNext,
+      (uint8_t)(StreamTxCount >> 8), (uint8_t)StreamTxCount,
+      SX126X_STREAM_FRAGMENT_SIZE
+    };
+    QueueFrame(data, len, StreamTxTimeoutMs, header, SX126X_STREAM_HEADER_SIZE);
+    StreamTxNext++;
+  }
+}
+
+
+// TX_DONE of a fragment, called by FinishTx() after the next fragment has been started
+void SX126x::StreamFragmentSent(uint8_t len)
+{
+  if ( !StreamTxActive ) {
+    return;
+  }
+
+  if ( TxStatus == ERR_NONE ) 
+  {
+    StreamTxSent += len;
+    if ( StreamTxSent >= StreamTxLen ) {
+      StreamTxActive = false;
+    }
+    else {
+      StreamFill();
+    }
+  }
+  else {
+    StreamTxActive = false;
+  }
+
+  // the queue may have run dry while the source had nothing ready
+  if ( StreamTxActive && !txActive && TxQueueCount() > 0 ) 
+  {
+    SX126xTxFrame* next = &TxQueue[TxQueueTail % SX126X_TX_QUEUE_DEPTH];
+    if ( DutyCycleAllows(next->len + next->headerLen) ) 
+    {
+      txActive = true;
+      StartQueuedTx();
+    }
+  }
+
+  if ( __streamTxHook != nullptr ) {
+    __streamTxHook(TxStatus, StreamTxSent, StreamTxLen);
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Reassembles streams sent with StreamSend(). Received frames that start with SX126X_STREAM_MARKER are taken as
+//  fragments: the payload is read from the chip straight to its place in buffer, the frame does not go through the RX
+//  ring or the RX hook. Other frames are received as usual. The radio has to be receiving, e.g. in the default
+//  continuous RX mode.
+//
+//  The stream RX hook is called after each fragment with the bytes received so far and, until the last fragment, the
+//  largest possible length of the transfer. The call for the last fragment has the exact length and ERR_NONE, or
+//  ERR_STREAM_INCOMPLETE if fragments were lost; fragments with a CRC error count as lost. A fragment of a new transfer
+//  ends an unfinished one with ERR_STREAM_INCOMPLETE. A transfer that does not fit in buffer ends with
+//  ERR_PACKET_TOO_LONG.
+//
+//  Fragments are placed by the fragment size in their header, so the sender may be built with another
+//  SX126X_STREAM_FRAGMENT_SIZE. A frame whose header does not add up, e.g. a short fragment before the last, is not a
+//  fragment: without protocol framing it is received as an application frame, with SetProtocolFraming(true) it is
+//  dropped and counts as lost. Only with framing on both ends can an application frame never be taken for a fragment.
+//
+//  Parameters:
+//  buffer - receives the transfers, NULL turns stream reception off
+//  maxLen - size of buffer
+//
+//  Return value:
+//  ERR_NONE
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::StreamReceive(uint8_t *buffer, uint32_t maxLen)
+{
+  StreamRxInTransfer = false;
+  StreamRxMax = maxLen;
+  StreamRxBuffer = buffer;
+  return ERR_NONE;
+}
+
+
+// header holds the first SX126X_RX_PEEK_SIZE bytes of the frame, returns false if it is not a fragment and has to be
+// read as a normal frame
+bool SX126x::ReceiveFragment(const uint8_t *header, uint8_t len, uint8_t offset)
+{
+  if ( len <= SX126X_STREAM_HEADER_SIZE || header[0] != SX126X_STREAM_MARKER ) {
+    return false;
+  }
+
+  uint16_t index = (header[2] << 8) | header[3];
+  uint16_t count = (header[4] << 8) | header[5];
+  uint8_t  fragmentSize = header[6];
+  uint8_t  payloadLen = len - SX126X_STREAM_HEADER_SIZE;
+  // without protocol framing a frame that is not a valid fragment may be an application frame that starts with the marker
+  if ( index >= count || payloadLen > fragmentSize || (index < count - 1 && payloadLen != fragmentSize) ) {
+    return ProtocolFraming;
+  }
+
+  if ( !StreamRxInTransfer || header[1] != StreamRxId || count != StreamRxCount || fragmentSize != StreamRxFragmentSize ) 
+  {
+    if ( StreamRxInTransfer && StreamRxNext < StreamRxCount ) {
+      EndStreamRx(ERR_STREAM_INCOMPLETE);
+    }
+    StreamRxInTransfer = true;
+    StreamRxId         = header[1];
+    StreamRxFragmentSize = fragmentSize;
+    StreamRxCount      = count;
+    StreamRxNext       = 0;
+    StreamRxReceived   = 0;
+    StreamRxBytes      = 0;
+    StreamRxTotal      = (uint32_t)count * fragmentSize;
+  }
+
+  // fragments are sent in order, an older one is a repetition
+  if ( index < StreamRxNext ) {
+    return true;
+  }
+
+  uint32_t position = (uint32_t)index * fragmentSize;
+  if ( position + payloadLen > StreamRxMax ) 
+  {
+    // the rest of the transfer is ignored
+    StreamRxNext = StreamRxCount;
+    if ( __streamRxHook != nullptr ) {
+      __streamRxHook(ERR_PACKET_TOO_LONG, StreamRxBytes, StreamRxTotal);
+    }
+    return true;
+  }
+
+  ReadBufferAt(offset + SX126X_STREAM_HEADER_SIZE, StreamRxBuffer + position, payloadLen);
+  StreamRxReceived++;
+  StreamRxBytes += payloadLen;
+  StreamRxNext = index + 1;
+
+  if ( index == count - 1 ) 
+  {
+    StreamRxTotal = position + payloadLen;
+    EndStreamRx((StreamRxReceived == count) ? ERR_NONE : ERR_STREAM_INCOMPLETE);
+  }
+  else if ( __streamRxHook != nullptr ) {
+    __streamRxHook(ERR_NONE, StreamRxBytes, StreamRxTotal);
+  }
+
+  return true;
+}
+
+
+void SX126x::EndStreamRx(uint8_t status)
+{
+  StreamRxInTransfer = false;
+  if ( __streamRxHook != nullptr ) {
+    __streamRxHook(status, StreamRxBytes, StreamRxTotal);
+  }
+}
+
+
+// provides the fragments of a StreamSend() without a buffer, see StreamSend()
+void SX126x::setStreamSource(uint8_t* (*source)(uint32_t offset, uint16_t len))
+{
+  __streamSource = source;
+}
+
+
+void SX126x::setStreamTxHook(void (*streamHook)(uint8_t status, uint32_t sent, uint32_t total))
+{
+  __streamTxHook = streamHook;
+}
+
+
+void SX126x::setStreamRxHook(void (*streamHook)(uint8_t status, uint32_t received, uint32_t total))
+{
+  __streamRxHook = streamHook;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Sends a frame over the reliable link. Frames are numbered and go out in bursts of up to SX126X_ARQ_WINDOW frames back
+//  to back, and only the last frame of a burst asks for an acknowledgement, so the radios turn around between RX and TX
+//  once per burst instead of once per frame. The receiver answers with the next sequence number it expects and a bitmap
+//  of the frames it already has beyond it, and the next burst repeats only the frames missing from it. Without an answer
+//  within the acknowledgement's time on air plus SX126X_ARQ_TURNAROUND_US, Service() repeats the newest unacknowledged
+//  frame to ask for it again. A frame is given up after SX126X_ARQ_MAX_RETRIES retransmissions, and the receiver stops
+//  waiting for it.
+//
+//  The reliable TX hook reports every frame with its sequence number: ERR_NONE once it has been acknowledged, otherwise
+//  the reason it was given up. The data is not copied, pData must stay valid until then. The radio has to receive
+//  between bursts, so use a continuous RX default mode, and call Service() from loop() for the acknowledgement timer.
+//
+//  Parameters:
+//  pData, len - frame to send, up to SX126X_BUFFER_SIZE - SX126X_ARQ_HEADER_SIZE bytes
+//  seq        - optional, receives the frame's sequence number
+//
+//  Return value:
+//  ERR_NONE, ERR_PACKET_TOO_LONG, ERR_DEVICE_BUSY when SX126X_ARQ_WINDOW frames wait for acknowledgement or the radio
+//  is being configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::ReliableSend(uint8_t *pData, uint8_t len, uint8_t *seq)
+{
+  if ( len > SX126X_BUFFER_SIZE - SX126X_ARQ_HEADER_SIZE ) {
+    return ERR_PACKET_TOO_LONG;
+  }
+  if ( ConfigPending() || ReliablePending() >= SX126X_ARQ_WINDOW ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  // 0 is the receiver's "no session yet"
+  if ( ArqTxSession == 0 ) {
+    ArqTxSession = 1 + Random() % 255;
+  }
+
+  uint8_t next = ArqTxNextSeq;
+  SX126xArqFrame* frame = &ArqTx[next % SX126X_ARQ_WINDOW];
+  frame->data = pData;
+  frame->len = len;
+  frame->retries = 0;
+  frame->pending = true;
+  frame->done = false;
+  ArqTxNextSeq = next + 1;
+  if ( seq != NULL ) {
+    *seq = next;
+  }
+
+  if ( !txActive && !ArqAckWait ) 
+  {
+    txActive = true;
+    if ( !ArqStartNext() ) {
+      txActive = false;
+    }
+  }
+
+  return ERR_NONE;
+}
+
+
+// frames sent with ReliableSend() that are neither acknowledged nor given up yet
+uint8_t SX126x::ReliablePending(void)
+{
+  return (uint8_t)(ArqTxNextSeq - ArqTxBase);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Turns the receiving side of the reliable link on or off. While on, frames of ReliableSend() are acknowledged when the
+//  sender asks for it, repeated frames are dropped and new ones are received like any other frame, without their header.
+//  Frames that arrive after a lost one are delivered right away, so the order can differ from the order they were sent
+//  in. A frame is only acknowledged once it has a place in the RX ring or has been handed to the RX hook.
+//
+//  Parameters:
+//  enable - true to receive and acknowledge reliable frames
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::ReliableReceive(bool enable)
+{
+  ArqRxSession = 0;
+  ArqRxEnabled = enable;
+}
+
+
+void SX126x::setReliableTxHook(void (*reliableHook)(uint8_t status, uint8_t seq))
+{
+  __reliableTxHook = reliableHook;
+}
+
+
+// starts the first frame of the window that waits for transmission, txActive must already be set, returns false if there
+// is none or it has to wait
+bool SX126x::ArqStartNext(void)
+{
+  if ( ArqAckWait || ConfigPending() ) {
+    return false;
+  }
+
+  uint8_t seq = ArqTxBase;
+  while ( seq != ArqTxNextSeq && !ArqTx[seq % SX126X_ARQ_WINDOW].pending ) {
+    seq++;
+  }
+  if ( seq == ArqTxNextSeq ) {
+    return false;
+  }
+
+  SX126xArqFrame* frame = &ArqTx[seq % SX126X_ARQ_WINDOW];
+  if ( !DutyCycleAllows(frame->len + SX126X_ARQ_HEADER_SIZE) ) {
+    return false;
+  }
+
+  // the last frame of the burst asks for the acknowledgement
+  bool last = true;
+  for ( uint8_t n = seq + 1; n != ArqTxNextSeq; n++ ) 
+  {
+    if ( ArqTx[n % SX126X_ARQ_WINDOW].pending ) 
+    {
+      last = false;
+      break;
+    }
+  }
+
+  uint8_t header[SX126X_ARQ_HEADER_SIZE] = {
+    SX126X_ARQ_DATA_MARKER, ArqTxSession, ArqTxBase, seq, (uint8_t)(last ? SX126X_ARQ_FLAG_ACK_REQUEST : 0)
+  };
+  frame->pending = false;
+  ArqTxSeq = seq;
+  ArqTxOnAir = true;
+  ArqTxAckRequested = last;
+  TxFragmentLen = 0;
+  if ( StartTx(frame->data, frame->len, SX126X_TIMEOUT_AUTO, header, SX126X_ARQ_HEADER_SIZE) == ERR_BUSY_TIMEOUT ) 
+  {
+    ArqTxOnAir = false;
+    frame->pending = true;
+    return false;
+  }
+
+  return true;
+}
+
+
+// TX_DONE, TX timeout or failed listen before talk of a reliable frame, before FinishTx() starts the next one
+void SX126x::ArqFrameSent(void)
+{
+  SX126xArqFrame* frame = &ArqTx[ArqTxSeq % SX126X_ARQ_WINDOW];
+
+  if ( TxStatus != ERR_NONE ) 
+  {
+    if ( frame->retries++ < SX126X_ARQ_MAX_RETRIES ) {
+      frame->pending = true;
+    }
+    else 
+    {
+      frame->done = true;
+      if ( __reliableTxHook != nullptr ) {
+        __reliableTxHook(TxStatus, ArqTxSeq);
+      }
+      ArqSlide();
+    }
+  }
+  else if ( ArqTxAckRequested ) 
+  {
+    ArqAckDeadline = Hal->Micros() + GetTimeOnAir(SX126X_ARQ_ACK_SIZE) + SX126X_ARQ_TURNAROUND_US;
+    ArqAckWait = true;
+  }
+}
+
+
+// Schedules the unacknowledged frames for the next burst, or with all false only the newest of them: whether that frame or
+// the acknowledgement got lost, repeating it asks for the acknowledgement again and costs one frame instead of a burst.
+// Frames out of retries are given up.
+void SX126x::ArqRetransmit(bool all)
+{
+  for ( uint8_t seq = ArqTxNextSeq; seq != ArqTxBase; ) 
+  {
+    seq--;
+    SX126xArqFrame* frame = &ArqTx[seq % SX126X_ARQ_WINDOW];
+    if ( frame->done || frame->pending ) {
+      continue;
+    }
+
+    if ( frame->retries++ < SX126X_ARQ_MAX_RETRIES ) 
+    {
+      frame->pending = true;
+      if ( !all ) {
+        break;
+      }
+    }
+    else 
+    {
+      frame->done = true;
+      if ( __reliableTxHook != nullptr ) {
+        __reliableTxHook(ERR_NO_ACK, seq);
+      }
+    }
+  }
+  ArqSlide();
+
+  if ( !txActive ) 
+  {
+    txActive = true;
+    if ( !ArqStartNext() ) {
+      txActive = false;
+    }
+  }
+}
+
+
+// moves the window past the frames that are done
+void SX126x::ArqSlide(void)
+{
+  uint8_t base = ArqTxBase;
+  while ( base != ArqTxNextSeq && ArqTx[base % SX126X_ARQ_WINDOW].done ) {
+    base++;
+  }
+  ArqTxBase = base;
+}
+
+
+// Returns true if the received frame ends here: an acknowledgement, or a reliable frame that was received before. For a
+// new reliable frame, len and offset are moved past its header and false is returned so it is received as usual. header
+// holds the first SX126X_RX_PEEK_SIZE bytes of the frame, an acknowledgement is as long as a header.
+bool SX126x::ReceiveReliable(const uint8_t *header, uint8_t *len, uint8_t *offset)
+{
+  if ( (!ArqRxEnabled && ArqTxSession == 0) || *len < SX126X_ARQ_HEADER_SIZE ) {
+    return false;
+  }
+
+  if ( header[0] == SX126X_ARQ_ACK_MARKER && header[1] == ArqTxSession && ArqTxSession != 0 ) 
+  {
+    uint8_t expected = header[2];
+    uint16_t bitmap = (header[3] << 8) | header[4];
+    for ( uint8_t seq = ArqTxBase; seq != ArqTxNextSeq; seq++ ) 
+    {
+      SX126xArqFrame* frame = &ArqTx[seq % SX126X_ARQ_WINDOW];
+      int8_t distance = (int8_t)(seq - expected);
+      if ( !frame->done && (distance < 0 || (distance > 0 && distance <= 16 && (bitmap & (1 << (distance - 1))))) ) 
+      {
+        frame->done = true;
+        frame->pending = false;
+        if ( __reliableTxHook != nullptr ) {
+          __reliableTxHook(ERR_NONE, seq);
+        }
+      }
+    }
+
+    // a late acknowledgement only counts for what it confirms
+    if ( ArqAckWait ) 
+    {
+      ArqAckWait = false;
+      ArqRetransmit(true);
+    }
+    else {
+      ArqSlide();
+    }
+    return true;
+  }
+
+  if ( header[0] != SX126X_ARQ_DATA_MARKER || !ArqRxEnabled ) {
+    return false;
+  }
+
+  // a new session means the sender has restarted, take its window as it is
+  if ( header[1] != ArqRxSession ) 
+  {
+    ArqRxSession = header[1];
+    ArqRxBase = header[2];
+    ArqRxBitmap = 0;
+  }
+
+  // the sender has given up the frames before its window base, stop waiting for them
+  while ( (int8_t)(header[2] - ArqRxBase) > 0 ) {
+    ArqAdvanceRx();
+  }
+
+  if ( header[4] & SX126X_ARQ_FLAG_ACK_REQUEST ) {
+    ArqAckDue = true;
+  }
+
+  int8_t distance = (int8_t)(header[3] - ArqRxBase);
+  bool fresh = (distance == 0) || (distance > 0 && distance <= 16 && !(ArqRxBitmap & (1 << (distance - 1))));
+  if ( !fresh ) {
+    return true;
+  }
+
+  // without a place in the ring the frame is left unacknowledged, the sender repeats it
+  if ( RxRingCount() >= SX126X_RX_RING_SLOTS ) 
+  {
+#if SX126X_STATS
+    Stats.rxDropped++;
+#endif
+    return true;
+  }
+
+  if ( distance == 0 ) {
+    ArqAdvanceRx();
+  }
+  else {
+    ArqRxBitmap |= 1 << (distance - 1);
+  }
+
+  *offset += SX126X_ARQ_HEADER_SIZE;
+  *len -= SX126X_ARQ_HEADER_SIZE;
+  return false;
+}
+
+
+// the expected frame has been received or given up, moves on to the next one that is still missing
+void SX126x::ArqAdvanceRx(void)
+{
+  ArqRxBase++;
+  while ( ArqRxBitmap & 1 ) 
+  {
+    ArqRxBase++;
+    ArqRxBitmap >>= 1;
+  }
+  ArqRxBitmap >>= 1;
+}
+
+
+// answers the sender with the next expected sequence number and the frames received beyond it
+void SX126x::SendAck(void)
+{
+  uint8_t ack[SX126X_ARQ_ACK_SIZE] = {
+    SX126X_ARQ_ACK_MARKER, ArqRxSession, ArqRxBase, (uint8_t)(ArqRxBitmap >> 8), (uint8_t)ArqRxBitmap
+  };
+
+  // without an answer the sender asks again
+  if ( txActive || !DutyCycleAllows(SX126X_ARQ_ACK_SIZE) ) {
+    return;
+  }
+
+  txActive = true;
+  ArqTxAckOnAir = true;
+  TxFragmentLen = 0;
+  if ( StartTx(ack, SX126X_ARQ_ACK_SIZE, SX126X_TIMEOUT_AUTO) == ERR_BUSY_TIMEOUT ) 
+  {
+    ArqTxAckOnAir = false;
+    txActive = false;
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Turns on link adaptation over a ladder of LoRa rates ordered from the fastest to the most robust, e.g. SF7 to SF12;
+//  both ends need the same ladder. The margin of every received frame, its SNR above the demodulation floor of the
+//  spreading factor or, once the SNR estimate saturates, its signal RSSI above the sensitivity, is tracked with a fast
+//  attack and a slow release. LinkReport() sends it to the peer. When the peer's report arrives, or when LinkAdapt() is
+//  called, the fastest rate is chosen at which the weaker direction, counting the TX power its sender has left, keeps
+//  targetMarginInDb, then the lowest TX power that keeps the target at the peer.
+//
+//  A rate change is agreed on the current rate: SWITCH is answered with SWITCH_ACK, after which the answering end
+//  switches, and the initiator switches when it hears the SWITCH_ACK and sends CONFIRM on the new rate. An end that does
+//  not hear the CONFIRM goes back to the old rate, and after SX126X_LINK_SILENCE_MS without a received frame both ends
+//  fall back to the most robust rate at maxPowerInDbm, so the two ends can not stay apart. A switch only sends
+//  SetModulationParams and a power change only SetTxParams, everything else stays configured.
+//
+//  The link hook reports a completed switch with ERR_NONE, a switch that was given up with ERR_NO_ACK and the fallback
+//  with ERR_RX_TIMEOUT, each with the rate index and the TX power in use afterwards.
+//
+//  Parameters:
+//  rates, count      - rate ladder, fastest first, not copied
+//  rate              - index of the rate to start on, the same on both ends
+//  minPowerInDbm     - lowest TX power to use
+//  maxPowerInDbm     - highest TX power to use, the link starts with it
+//  targetMarginInDb  - margin to keep above the demodulation floor
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN for an empty ladder or a rate outside of it, ERR_INVALID_MODE outside LoRa, ERR_DEVICE_BUSY
+//  while the radio is sending or being configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::LinkAdaptBegin(const SX126xLinkRate *rates, uint8_t count, uint8_t rate, int8_t minPowerInDbm, int8_t maxPowerInDbm, int8_t targetMarginInDb)
+{
+  if ( rates == NULL || count == 0 || rate >= count || minPowerInDbm > maxPowerInDbm ) {
+    return ERR_UNKNOWN;
+  }
+  if ( PacketType != SX126X_PACKET_TYPE_LORA ) {
+    return ERR_INVALID_MODE;
+  }
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  LinkRates       = rates;
+  LinkRateCount   = count;
+  LinkRate        = rate;
+  LinkMinPower    = minPowerInDbm;
+  LinkMaxPower    = maxPowerInDbm;
+  LinkPower       = maxPowerInDbm;
+  LinkTargetQdb   = targetMarginInDb * 4;
+  LinkLocalValid  = false;
+  LinkPeerValid   = false;
+  LinkPeerHeadQdb = 0;
+  LinkState       = SX126X_LINK_STATE_IDLE;
+  LinkTimerArmed  = false;
+  LinkTxPending   = SX126X_LINK_NONE;
+  LinkHeardMs     = Hal->Millis();
+
+  SetTxPower(LinkPower);
+  ApplyLinkRate(rate);
+
+  return ERR_NONE;
+}
+
+
+// turns link adaptation off, the rate and TX power in use stay
+void SX126x::LinkAdaptEnd(void)
+{
+  LinkRates = NULL;
+  LinkState = SX126X_LINK_STATE_IDLE;
+  LinkTimerArmed = false;
+  LinkTxPending = SX126X_LINK_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Chooses rate and TX power from the margins measured so far, see LinkAdaptBegin(). A new TX power is used at once, a
+//  new rate is requested from the peer. Called by the driver whenever a report of the peer arrives.
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN without link adaptation or a margin of the peer, ERR_DEVICE_BUSY while a switch is under way
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::LinkAdapt(void)
+{
+  if ( LinkRates == NULL || !LinkPeerValid ) {
+    return ERR_UNKNOWN;
+  }
+  if ( LinkState != SX126X_LINK_STATE_IDLE ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  // both directions share the rate, so the weaker one decides, each with the TX power its sender has left
+  int16_t margin = LinkPeerQdb + (LinkMaxPower - LinkPower) * 4;
+  if ( LinkLocalValid && LinkLocalQdb + LinkPeerHeadQdb < margin ) {
+    margin = LinkLocalQdb + LinkPeerHeadQdb;
+  }
+
+  uint8_t rate = LinkRateCount - 1;
+  for ( uint8_t r = 0; r < LinkRateCount - 1; r++ ) 
+  {
+    int16_t needed = LinkTargetQdb + ((r < LinkRate) ? SX126X_LINK_HYSTERESIS_DB * 4 : 0);
+    if ( margin + LinkRateDelta(LinkRate, r) >= needed ) 
+    {
+      rate = r;
+      break;
+    }
+  }
+
+  // lowest power that keeps the target at the peer on that rate, a surplus has to exceed the hysteresis to count
+  int16_t surplus = LinkPeerQdb + LinkRateDelta(LinkRate, rate) - LinkTargetQdb;
+  int16_t power = LinkPower;
+  if ( surplus < 0 ) {
+    power += (-surplus + 3) / 4;
+  }
+  else if ( surplus >= SX126X_LINK_HYSTERESIS_DB * 4 ) {
+    power -= surplus / 4;
+  }
+  power = (power < LinkMinPower) ? LinkMinPower : (power > LinkMaxPower) ? LinkMaxPower : power;
+
+  if ( rate == LinkRate ) 
+  {
+    if ( power != LinkPower ) 
+    {
+      LinkPeerQdb += (power - LinkPower) * 4;
+      LinkPower = power;
+      SetTxPower(LinkPower);
+    }
+    return ERR_NONE;
+  }
+
+  LinkNextRate = rate;
+  LinkNextPower = power;
+  LinkAttempts = 0;
+  LinkState = SX126X_LINK_STATE_SWITCH_SENT;
+  LinkSend(SX126X_LINK_SWITCH);
+
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Sends our margin to the peer, which adapts the link from it. Call it often enough for the peer to follow the link, and
+//  more often than SX126X_LINK_SILENCE_MS when there is no other traffic.
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN without link adaptation, ERR_DEVICE_BUSY while the radio is sending
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::LinkReport(void)
+{
+  if ( LinkRates == NULL ) {
+    return ERR_UNKNOWN;
+  }
+  if ( txActive ) {
+    return ERR_DEVICE_BUSY;
+  }
+
+  LinkSend(SX126X_LINK_REPORT);
+  return ERR_NONE;
+}
+
+
+// margin of the frames we receive in dB, SX126X_LINK_NO_MARGIN before the first one
+int8_t SX126x::GetLinkMargin(void)
+{
+  if ( !LinkLocalValid ) {
+    return SX126X_LINK_NO_MARGIN;
+  }
+  return SX126xQuarterDbToDb((LinkLocalQdb < -127 * 4) ? -127 * 4 : (LinkLocalQdb > 127 * 4) ? 127 * 4 : LinkLocalQdb);
+}
+
+
+// margin of our frames at the peer and the TX power the peer has left in dB, when the application carries the reports
+void SX126x::SetPeerMargin(int8_t marginInDb, uint8_t headroomInDb)
+{
+  LinkPeerValid = (marginInDb != SX126X_LINK_NO_MARGIN);
+  LinkPeerQdb = marginInDb * 4;
+  LinkPeerHeadQdb = headroomInDb * 4;
+}
+
+
+uint8_t SX126x::GetLinkRate(void)
+{
+  return LinkRate;
+}
+
+
+int8_t SX126x::GetLinkTxPower(void)
+{
+  return LinkPower;
+}
+
+
+void SX126x::setLinkHook(void (*linkHook)(uint8_t status, uint8_t rate, int8_t txPowerInDbm))
+{
+  __linkHook = linkHook;
+}
+
+
+// change of the margin when going from one rate of the ladder to another, dB * 4
+int16_t SX126x::LinkRateDelta(uint8_t from, uint8_t to)
+{
+  const SX126xLinkRate* a = &LinkRates[from];
+  const SX126xLinkRate* b = &LinkRates[to];
+  return SX126xLoRaSnrFloor(a->spreadingFactor) - SX126xLoRaSnrFloor(b->spreadingFactor) +
+         SX126xLoRaNoiseFloor(a->bandwidth) - SX126xLoRaNoiseFloor(b->bandwidth);
+}
+
+
+// switches the modem to a rate of the ladder, with the measured margins carried over
+void SX126x::ApplyLinkRate(uint8_t rate)
+{
+  const SX126xLinkRate* r = &LinkRates[rate];
+  uint8_t params[4] = { r->spreadingFactor, r->bandwidth, r->codingRate, SX126xLoRaLowDataRateOptimize(r->spreadingFactor, r->bandwidth) };
+
+  int16_t delta = LinkRateDelta(LinkRate, rate);
+  LinkLocalQdb += delta;
+  LinkPeerQdb += delta;
+  LinkRate = rate;
+
+  if ( memcmp(params, ModulationParams, sizeof(params)) == 0 ) {
+    return;
+  }
+
+  // the modem is reconfigured in standby, packet, frequency and PA setup stay as they are
+  if ( ChipMode != SX126X_STATUS_MODE_STDBY_RC && ChipMode != SX126X_STATUS_MODE_STDBY_XOSC ) {
+    SetStandby(SX126X_STANDBY_RC);
+  }
+  memcpy(ModulationParams, params, sizeof(params));
+  SPIwriteCommand(SX126X_CMD_SET_MODULATION_PARAMS, ModulationParams, 4);
+
+  if ( !txActive ) {
+    EnterDefaultMode();
+  }
+}
+
+
+// takes the margin of a received frame into the running estimate
+void SX126x::LinkMeasure(const SX126xPacketStatus *status)
+{
+  const SX126xLinkRate* r = &LinkRates[LinkRate];
+  int16_t margin = status->snr - SX126xLoRaSnrFloor(r->spreadingFactor);
+
+  // a few dB above the noise the SNR estimate saturates, the signal level tells more
+  if ( status->snr >= 5 * 4 ) 
+  {
+    int16_t levelMargin = status->signalRssi - SX126xLoRaSensitivity(r->spreadingFactor, r->bandwidth);
+    if ( levelMargin > margin ) {
+      margin = levelMargin;
+    }
+  }
+
+  // a fade counts at once, an improvement only on average
+  if ( !LinkLocalValid || margin < LinkLocalQdb ) {
+    LinkLocalQdb = margin;
+  }
+  else {
+    LinkLocalQdb += (margin - LinkLocalQdb) / 8;
+  }
+  LinkLocalValid = true;
+}
+
+
+// sends a link frame, or leaves it to Service() while the radio is busy
+void SX126x::LinkSend(uint8_t type)
+{
+  if ( txActive || !DutyCycleAllows(SX126X_LINK_FRAME_SIZE) ) 
+  {
+    LinkTxPending = type;
+    return;
+  }
+
+  uint8_t frame[SX126X_LINK_FRAME_SIZE] = {
+    SX126X_LINK_MARKER, type,
+    (type == SX126X_LINK_SWITCH || type == SX126X_LINK_SWITCH_ACK) ? LinkNextRate : LinkRate,
+    (uint8_t)GetLinkMargin(), (uint8_t)(LinkMaxPower - LinkPower)
+  };
+
+  txActive = true;
+  LinkTxOnAir = true;
+  LinkTxType = type;
+  TxFragmentLen = 0;
+  if ( StartTx(frame, SX126X_LINK_FRAME_SIZE, SX126X_TIMEOUT_AUTO) == ERR_BUSY_TIMEOUT ) 
+  {
+    LinkTxOnAir = false;
+    txActive = false;
+  }
+}
+
+
+// TX_DONE of a link frame, before FinishTx() returns to the default mode
+void SX126x::LinkFrameSent(void)
+{
+  if ( LinkTxType == SX126X_LINK_SWITCH ) 
+  {
+    // time for the peer to answer, a request that did not go out is sent again when it passes
+    LinkDeadline = Hal->Micros() + GetTimeOnAir(SX126X_LINK_FRAME_SIZE) + SX126X_LINK_TURNAROUND_US;
+    LinkTimerArmed = true;
+  }
+  else if ( LinkTxType == SX126X_LINK_SWITCH_ACK && LinkState == SX126X_LINK_STATE_SWITCH_ACKED ) 
+  {
+    if ( TxStatus != ERR_NONE ) 
+    {
+      LinkState = SX126X_LINK_STATE_IDLE;
+      return;
+    }
+
+    // the initiator switches when it hears the SWITCH_ACK and sends CONFIRM on the new rate right away
+    LinkPrevRate = LinkRate;
+    ApplyLinkRate(LinkNextRate);
+    LinkState = SX126X_LINK_STATE_WAIT_CONFIRM;
+    LinkDeadline = Hal->Micros() + 2 * GetTimeOnAir(SX126X_LINK_FRAME_SIZE) + SX126X_LINK_TURNAROUND_US;
+    LinkTimerArmed = true;
+  }
+}
+
+
+// frame holds the first SX126X_RX_PEEK_SIZE bytes of the received frame, returns true if it is a link frame, which ends
+// here
+bool SX126x::ReceiveLink(const uint8_t *frame, uint8_t len)
+{
+  if ( LinkRates == NULL || len != SX126X_LINK_FRAME_SIZE || frame[0] != SX126X_LINK_MARKER ) {
+    return false;
+  }
+
+  SX126xPacketStatus status;
+  GetPacketStatus(&status);
+  LinkMeasure(&status);
+  if ( (int8_t)frame[3] != SX126X_LINK_NO_MARGIN ) 
+  {
+    LinkPeerQdb = (int8_t)frame[3] * 4;
+    LinkPeerValid = true;
+  }
+  LinkPeerHeadQdb = frame[4] * 4;
+
+  uint8_t rate = frame[2];
+  switch ( frame[1] ) 
+  {
+    case SX126X_LINK_REPORT:
+      LinkAdapt();
+      break;
+
+    // a request of the peer wins over our own
+    case SX126X_LINK_SWITCH:
+      if ( rate < LinkRateCount && (LinkState == SX126X_LINK_STATE_IDLE || LinkState == SX126X_LINK_STATE_SWITCH_SENT) ) 
+      {
+        LinkTimerArmed = false;
+        LinkNextRate = rate;
+        LinkState = SX126X_LINK_STATE_SWITCH_ACKED;
+        LinkSend(SX126X_LINK_SWITCH_ACK);
+      }
+      break;
+
+    case SX126X_LINK_SWITCH_ACK:
+      if ( LinkState == SX126X_LINK_STATE_SWITCH_SENT && rate == LinkNextRate ) 
+      {
+        LinkTimerArmed = false;
+        ApplyLinkRate(rate);
+        if ( LinkNextPower != LinkPower ) 
+        {
+          LinkPeerQdb += (LinkNextPower - LinkPower) * 4;
+          LinkPower = LinkNextPower;
+          SetTxPower(LinkPower);
+        }
+        LinkState = SX126X_LINK_STATE_IDLE;
+        LinkSend(SX126X_LINK_CONFIRM);
+        EndLinkSwitch(ERR_NONE);
+      }
+      break;
+
+    case SX126X_LINK_CONFIRM:
+      if ( LinkState == SX126X_LINK_STATE_WAIT_CONFIRM ) 
+      {
+        LinkTimerArmed = false;
+        LinkState = SX126X_LINK_STATE_IDLE;
+        EndLinkSwitch(ERR_NONE);
+      }
+      break;
+  }
+
+  return true;
+}
+
+
+// the peer did not answer a SWITCH, or did not confirm after our SWITCH_ACK
+void SX126x::LinkTimeout(void)
+{
+  LinkTimerArmed = false;
+
+  if ( LinkState == SX126X_LINK_STATE_SWITCH_SENT ) 
+  {
+    if ( ++LinkAttempts < SX126X_LINK_SWITCH_RETRIES ) {
+      LinkSend(SX126X_LINK_SWITCH);
+    }
+    else 
+    {
+      LinkState = SX126X_LINK_STATE_IDLE;
+      EndLinkSwitch(ERR_NO_ACK);
+    }
+  }
+  else if ( LinkState == SX126X_LINK_STATE_WAIT_CONFIRM ) 
+  {
+    // the initiator did not switch, go back to where it still is
+    ApplyLinkRate(LinkPrevRate);
+    LinkState = SX126X_LINK_STATE_IDLE;
+    EndLinkSwitch(ERR_NO_ACK);
+  }
+}
+
+
+void SX126x::EndLinkSwitch(uint8_t status)
+{
+  if ( __linkHook != nullptr ) {
+    __linkHook(status, LinkRate, LinkPower);
+  }
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Turns on frequency hopping over a table of channels and tunes to one of them. A retune only sends SetRfFrequency
+//  with the frequency word of the table, and CalibrateImage with the band of the table, which the command shadow skips
+//  while the band stays the same; nothing is computed at run time.
+//
+//  With SX126X_HOP_AFTER_TX the radio moves to the next channel when a frame has been sent, before the next queued frame
+//  or the default mode starts, and with SX126X_HOP_AFTER_RX when a frame has been received, so both ends of a link
+//  follow the same sequence frame by frame. The next channel is the next one in the table or the one the hop hook
+//  returns. With SX126X_HOP_MANUAL only HopTo() changes the channel, e.g. from a dwell timer.
+//
+//  Parameters:
+//  channels, count   - hop table, not copied
+//  channel           - index of the channel to start on
+//  hopMode           - SX126X_HOP_MANUAL or SX126X_HOP_AFTER_TX and/or SX126X_HOP_AFTER_RX
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN for an empty table or a channel outside of it, ERR_DEVICE_BUSY while the radio is sending or
+//  being configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::HopBegin(const SX126xHopChannel *channels, uint8_t count, uint8_t channel, uint8_t hopMode)
+{
+  if ( channels == NULL || count == 0 || channel >= count ) {
+    return ERR_UNKNOWN;
+  }
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
   }
 
-  return rv;
+  HopChannels = channels;
+  HopCount    = count;
+  HopMode     = hopMode;
+  Retune(channel);
+
+  return ERR_NONE;
 }
 
 
-uint8_t SX126x::ReceiveMode(uint32_t timeoutInMs)
+// turns hopping off, the radio stays on the channel in use
+void SX126x::HopEnd(void)
 {
-  uint8_t rv = ERR_NONE;
+  HopChannels = NULL;
+  HopMode = SX126X_HOP_MANUAL;
+}
 
-  if ( txActive == true )
-  {
-    rv = ERR_DEVICE_BUSY;
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Tunes to a channel of the hop table. A running RX is stopped for the retune and started again on the new channel.
+//
+//  Return value:
+//  ERR_NONE, ERR_UNKNOWN without a hop table or for a channel outside of it, ERR_DEVICE_BUSY while the radio is sending or
+//  being configured
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::HopTo(uint8_t channel)
+{
+  if ( HopChannels == NULL || channel >= HopCount ) {
+    return ERR_UNKNOWN;
   }
-  else
-  {
-    uint8_t currentMode = GetCurrentMode();
-    if ( !currentMode & SX126X_STATUS_MODE_RX ) {
-      SetRx(timeoutInMs);
-    }
+  if ( txActive || ConfigPending() ) {
+    return ERR_DEVICE_BUSY;
   }
 
-  return rv;
+  Retune(channel);
+  return ERR_NONE;
 }
 
 
-void SX126x::ReceiveStatus(int8_t *rssiPacket, int8_t *snrPacket)
+uint8_t SX126x::GetHopChannel(void)
 {
-    uint8_t buf[3];
-     
-    SPIreadCommand( SX126X_CMD_GET_PACKET_STATUS, buf, 3 );
-
-    ( buf[1] < 128 ) ? ( *snrPacket = buf[1] >> 2 ) : ( *snrPacket = ( ( buf[1] - 256 ) >> 2 ) );
-    *rssiPacket = -(buf[0] >> 1);
+  return HopChannel;
 }
 
 
-void SX126x::Reset(void)
+// the hook gets the channel in use and returns the next one, an index outside the table stays on the channel in use
+void SX126x::setHopHook(uint8_t (*hopHook)(uint8_t channel))
 {
-  digitalWrite(SX126x_RESET, LOW);
-  delayMicroseconds(600);
-  digitalWrite(SX126x_RESET, HIGH);
-  while(digitalRead(SX126x_BUSY));
+  __hopHook = hopHook;
 }
 
 
-void SX126x::Wakeup(void)
+// the chip is tuned in standby, when it was busy with anything else the default mode is entered again afterwards
+void SX126x::Retune(uint8_t channel)
 {
-  GetStatus();
-}
-
+  const SX126xHopChannel* c = &HopChannels[channel];
+  HopChannel = channel;
+  if ( c->frequencyInHz == RfFrequency ) {
+    return;
+  }
 
-void SX126x::setTxDoneHook(void (*txHook)(uint8_t txStatus)) {
-  __txDoneHook = txHook;
-}
+  bool resume = (ChipMode != SX126X_STATUS_MODE_STDBY_RC && ChipMode != SX126X_STATUS_MODE_STDBY_XOSC);
+  if ( resume ) {
+    SetStandby(SX126X_STANDBY_RC);
+  }
 
+  uint8_t calFreq[2] = { c->calibrateImage[0], c->calibrateImage[1] };
+  uint8_t buf[4] = { c->rfFrequency[0], c->rfFrequency[1], c->rfFrequency[2], c->rfFrequency[3] };
+  SPIwriteCommand(SX126X_CMD_CALIBRATE_IMAGE, calFreq, 2);
+  SPIwriteCommand(SX126X_CMD_SET_RF_FREQUENCY, buf, 4);
+  RfFrequency = c->frequencyInHz;
 
-void SX126x::setRxDoneHook(void (*rxHook)(uint8_t rxStatus, uint8_t *pdata, uint16_t len)) {
-  __rxDoneHook = rxHook;
+  if ( resume && !txActive ) {
+    EnterDefaultMode();
+  }
 }
 
 
-void SX126x::Dio1Interrupt() 
+// moves on to the next channel between two frames
+void SX126x::NextHop(void)
 {
-  uint16_t irq = GetIrqStatus();
-  if( txActive ) 
-  {
-    if ( irq & (SX126X_IRQ_TX_DONE | SX126X_IRQ_TIMEOUT) ) 
-    {
-      txActive = false;
-      EnterDefaultMode();
-
-      if ( __txDoneHook != nullptr ) 
-      {
-        // uint16_t devErrors = GetDeviceErrors();
-        // Serial.print("Tx Done getErrors = ");
-        // Serial.println(devErrors, BIN);
-        __txDoneHook((irq & SX126X_IRQ_TIMEOUT) ? ERR_TX_TIMEOUT : ERR_NONE);
-      }
-    }
+  uint8_t next = (HopChannel + 1 < HopCount) ? HopChannel + 1 : 0;
+  if ( __hopHook != nullptr ) {
+    next = __hopHook(HopChannel);
   }
-  else if ( irq & (SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT) ) 
-  {
-    if ( __rxDoneHook != nullptr ) 
-    {
-      uint16_t len = SX126X_BUFFER_SIZE;
-      uint8_t* pRxData = new uint8_t[len];
-      uint8_t rxStatus = Receive(pRxData, &len);
-      __rxDoneHook(rxStatus, pRxData, len);
-      free(pRxData);
-    }
+  if ( next < HopCount ) {
+    Retune(next);
   }
 }
 
 
+// TX power in dBm for the high power PA, limited to -3 .. 22 dBm
+void SX126x::SetTxPower(int8_t txPowerInDbm)
+{
+  SetPowerConfig(txPowerInDbm, SX126X_PA_RAMP_800U);
+}
+
+
 uint8_t SX126x::GetCurrentMode(void) {
   return GetStatus() & 0x70;
 }
@@ -323,8 +3350,16 @@ uint8_t SX126x::GetCurrentMode(void) {
 //----------------------------------------------------------------------------------------------------------------------------
 void SX126x::SetStandby(uint8_t mode)
 {
+  uint8_t target = (mode == SX126X_STANDBY_XOSC) ? SX126X_STATUS_MODE_STDBY_XOSC : SX126X_STATUS_MODE_STDBY_RC;
+  if ( ChipMode == target ) 
+  {
+    CmdSuppressed++;
+    return;
+  }
+
+  // the shadowed mode is only trusted when the command made it to the chip
   uint8_t data = mode;
-  SPIwriteCommand(SX126X_CMD_SET_STANDBY, &data, 1);
+  ChipMode = (SPIwriteCommand(SX126X_CMD_SET_STANDBY, &data, 1) == ERR_NONE) ? target : SX126X_CHIP_MODE_UNKNOWN;
 }
 
 
@@ -350,21 +3385,91 @@ uint8_t SX126x::GetStatus(void)
 }
 
 
+uint8_t SX126x::GetPacketType(void)
+{
+  uint8_t packetType = 0x00;
+  SPIreadCommand(SX126X_CMD_GET_PACKET_TYPE, &packetType, 1);
+  return packetType;
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------------
 //  The BUSY line is mandatory to ensure the host controller is ready to accept SPI commands.
 //  When BUSY is high, the host controller must wait until it goes down again before sending another command.
+//  The wait gives up after BusyTimeoutUs (SetBusyTimeout()), so a module that hangs or is not connected can not wedge the
+//  host. The busy wait hook is called on every poll while BUSY is high; note that in SX126X_SERVICE_MODE_ISR this
+//  includes waits made from the DIO1 interrupt. The time spent waiting is added up for GetBusyStats().
 //
 //  Parameters:
 //  none
 //
 //
 //  Return value:
-//  none
+//  ERR_NONE or ERR_BUSY_TIMEOUT
 //  
 //----------------------------------------------------------------------------------------------------------------------------
-void SX126x::WaitOnBusy( void )
+uint8_t SX126x::WaitOnBusy( void )
+{
+  if ( !Hal->ReadBusy() ) {
+    return ERR_NONE;
+  }
+
+  uint32_t start = Hal->Micros();
+  while ( Hal->ReadBusy() ) 
+  {
+    uint32_t elapsed = Hal->Micros() - start;
+    if ( elapsed >= BusyTimeoutUs ) 
+    {
+      BusyWaitUs += elapsed;
+      BusyTimeouts++;
+      return ERR_BUSY_TIMEOUT;
+    }
+
+    if ( __busyHook != nullptr ) {
+      __busyHook(this);
+    }
+  }
+
+  BusyWaitUs += Hal->Micros() - start;
+  return ERR_NONE;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Time spent waiting for BUSY to fall and number of waits that gave up, since the radio was created.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::GetBusyStats(uint32_t *waitUs, uint32_t *timeouts)
+{
+  *waitUs = BusyWaitUs;
+  *timeouts = BusyTimeouts;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Copies the driver's counters, see SX126xStats. The copy is not atomic against the DIO1 interrupt, so a counter the
+//  interrupt updates while it is taken may be off by one event.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::GetStats(SX126xStats *stats)
+{
+  *stats = Stats;
+  stats->spiCommands   = CmdIssued;
+  stats->spiSuppressed = CmdSuppressed;
+  stats->busyWaitUs    = BusyWaitUs;
+  stats->busyTimeouts  = BusyTimeouts;
+}
+
+
+// longest time a BUSY wait may take before the command fails with ERR_BUSY_TIMEOUT
+void SX126x::SetBusyTimeout(uint32_t timeoutInUs)
+{
+  BusyTimeoutUs = timeoutInUs;
+}
+
+
+// called while waiting for BUSY, e.g. to feed a watchdog or run other work; it must not talk to this radio
+void SX126x::setBusyWaitHook(void (*busyHook)(SX126x* radio))
 {
-  while( digitalRead(SX126x_BUSY) == 1 );
+  __busyHook = busyHook;
 }
 
 
@@ -448,12 +3553,13 @@ void SX126x::SetRfFrequency(uint32_t frequency)
 
   CalibrateImage(frequency);
 
-  freq = (uint32_t)((double)frequency / (double)SX126X_FREQ_STEP);
+  freq = SX126xFrequencyWord(frequency);
   buf[0] = (uint8_t)((freq >> 24) & 0xFF);
   buf[1] = (uint8_t)((freq >> 16) & 0xFF);
   buf[2] = (uint8_t)((freq >> 8) & 0xFF);
   buf[3] = (uint8_t)(freq & 0xFF);
   SPIwriteCommand(SX126X_CMD_SET_RF_FREQUENCY, buf, 4);
+  RfFrequency = frequency;
 }
 
 
@@ -470,33 +3576,9 @@ void SX126x::SetRfFrequency(uint32_t frequency)
 //----------------------------------------------------------------------------------------------------------------------------
 void SX126x::CalibrateImage(uint32_t frequency)
 {
-  uint8_t calFreq[2];
+  uint16_t band = SX126xImageCalibration(frequency);
+  uint8_t calFreq[2] = { (uint8_t)(band >> 8), (uint8_t)band };
 
-  if( frequency > 900000000 )
-  {
-      calFreq[0] = SX126X_CAL_IMG_902_MHZ_1;
-      calFreq[1] = SX126X_CAL_IMG_902_MHZ_2;
-  }
-  else if( frequency > 850000000 )
-  {
-      calFreq[0] = SX126X_CAL_IMG_863_MHZ_1;
-      calFreq[1] = SX126X_CAL_IMG_863_MHZ_2;
-  }
-  else if( frequency > 770000000 )
-  {
-      calFreq[0] = SX126X_CAL_IMG_779_MHZ_1;
-      calFreq[1] = SX126X_CAL_IMG_779_MHZ_2;
-  }
-  else if( frequency > 460000000 )
-  {
-      calFreq[0] = SX126X_CAL_IMG_470_MHZ_1;
-      calFreq[1] = SX126X_CAL_IMG_470_MHZ_2;
-  }
-  else if( frequency > 425000000 )
-  {
-      calFreq[0] = SX126X_CAL_IMG_430_MHZ_1;
-      calFreq[1] = SX126X_CAL_IMG_430_MHZ_2;
-  }
   SPIwriteCommand(SX126X_CMD_CALIBRATE_IMAGE, calFreq, 2);
 }
 
@@ -686,6 +3768,40 @@ void SX126x::SetLoRaSymbNumTimeout(uint8_t SymbNum)
 }
 
 
+//----------------------------------------------------------------------------------------------------------------------------
+//  Writes a block of consecutive registers. Unlike SetOvercurrentProtection() this does not go through the command shadow,
+//  which only holds one register write; the GFSK registers are rewritten by RestoreShadow() from GfskRegisters instead.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::WriteRegister(uint16_t address, uint8_t *data, uint8_t len)
+{
+  uint8_t buf[2 + SX126X_GFSK_SYNC_WORD_MAX];
+
+  buf[0] = (uint8_t)((address & 0xFF00) >> 8);
+  buf[1] = (uint8_t)(address & 0x00FF);
+  memcpy(&buf[2], data, len);
+  SPItransfer(SX126X_CMD_WRITE_REGISTER, true, buf, NULL, 2 + len, true);
+}
+
+
+// sync word, node/broadcast address and the CRC seed and polynomial of the configured CRC type
+void SX126x::WriteGfskRegisters(void)
+{
+  WriteRegister(SX126X_REG_SYNC_WORD_0, GfskRegisters, SX126X_GFSK_SYNC_WORD_MAX);
+  WriteRegister(SX126X_REG_NODE_ADDRESS, &GfskRegisters[SX126X_GFSK_SYNC_WORD_MAX], 2);
+
+  uint8_t crcType = PacketParams[7];
+  if ( crcType == SX126X_GFSK_CRC_OFF ) {
+    return;
+  }
+
+  bool twoBytes = (crcType == SX126X_GFSK_CRC_2_BYTE || crcType == SX126X_GFSK_CRC_2_BYTE_INV);
+  uint16_t initial = twoBytes ? SX126X_GFSK_CRC_2_BYTE_INITIAL : SX126X_GFSK_CRC_1_BYTE_INITIAL;
+  uint16_t polynomial = twoBytes ? SX126X_GFSK_CRC_2_BYTE_POLYNOMIAL : SX126X_GFSK_CRC_1_BYTE_POLYNOMIAL;
+  uint8_t crc[4] = { (uint8_t)(initial >> 8), (uint8_t)initial, (uint8_t)(polynomial >> 8), (uint8_t)polynomial };
+  WriteRegister(SX126X_REG_CRC_INITIAL_MSB, crc, 4);
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------------
 //  The command...
 //
@@ -740,7 +3856,7 @@ void SX126x::SetModulationParams(uint8_t spreadingFactor, uint8_t bandwidth, uin
 //----------------------------------------------------------------------------------------------------------------------------
 uint16_t SX126x::GetIrqStatus( void )
 {
-    uint8_t data[2];
+    uint8_t data[2] = { 0, 0 };
     SPIreadCommand(SX126X_CMD_GET_IRQ_STATUS, data, 2);
     return (data[0] << 8) | data[1];
 }
@@ -759,11 +3875,23 @@ uint16_t SX126x::GetIrqStatus( void )
 //----------------------------------------------------------------------------------------------------------------------------
 void SX126x::ClearIrqStatus(uint16_t irq)
 {
+    // nothing to clear if none of these IRQs can have been raised since they were last cleared
+    if ( (IrqMaybeSet & irq) == 0 ) 
+    {
+      CmdSuppressed++;
+      return;
+    }
+
     uint8_t buf[2];
 
     buf[0] = (uint8_t)(((uint16_t)irq >> 8) & 0x00FF);
     buf[1] = (uint8_t)((uint16_t)irq & 0x00FF);
     SPIwriteCommand(SX126X_CMD_CLEAR_IRQ_STATUS, buf, 2);
+
+    // in standby or FS the chip raises no new IRQs, so what was cleared stays clear
+    if ( ChipMode == SX126X_STATUS_MODE_STDBY_RC || ChipMode == SX126X_STATUS_MODE_STDBY_XOSC || ChipMode == SX126X_STATUS_MODE_FS ) {
+      IrqMaybeSet &= ~irq;
+    }
 }
 
 
@@ -799,6 +3927,38 @@ void SX126x::EnterDefaultMode(void)
       SetRx(SX126X_RX_NO_TIMEOUT_SINGLE);
       break;
 
+    case(SX126X_DEFAULT_MODE_RX_DUTY_CYCLE):
+      if ( ChipMode != SX126X_CHIP_MODE_RX_DUTY_CYCLE ) {
+        SetRxDutyCycle(SniffPreamble);
+      }
+      break;
+
+    // between two CADs the chip sleeps, Service() starts the next one
+    case(SX126X_DEFAULT_MODE_CAD_RX):
+      if ( CadRxIntervalMs == 0 ) {
+        SetCad(SX126X_CAD_GOTO_RX, CadRxTimeout());
+      }
+      else 
+      {
+        CadRxDueMs = Hal->Millis() + CadRxIntervalMs;
+        CadRxPending = true;
+        SetSleep(SX126X_SLEEP_START_WARM | SX126X_SLEEP_RTC_OFF);
+      }
+      break;
+
+    case(SX126X_DEFAULT_MODE_SLEEP_WARM):
+      SetSleep(SX126X_SLEEP_START_WARM | SX126X_SLEEP_RTC_OFF);
+      break;
+
+    case(SX126X_DEFAULT_MODE_SLEEP_COLD):
+      SetSleep(SX126X_SLEEP_START_COLD | SX126X_SLEEP_RTC_OFF);
+      break;
+
+    // the chip may wake itself on the RTC, WakeIfAsleep() then just clocks a harmless GetStatus
+    case(SX126X_DEFAULT_MODE_SLEEP_WARM_RTC):
+      SetSleep(SX126X_SLEEP_START_WARM | SX126X_SLEEP_RTC_ON);
+      break;
+
     case(SX126X_DEFAULT_MODE_STBY_RC):
     default:
       SetStandby(SX126X_STANDBY_RC);
@@ -820,8 +3980,6 @@ void SX126x::EnterDefaultMode(void)
 //----------------------------------------------------------------------------------------------------------------------------
 void SX126x::SetRx(uint32_t timeoutInMs)
 {
-  ClearIrqStatus(SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT);
-
   uint32_t tout = 0;
   if ( timeoutInMs >= SX126X_RX_NO_TIMEOUT_CONT ) 
   {
@@ -832,11 +3990,27 @@ void SX126x::SetRx(uint32_t timeoutInMs)
     tout = timeoutInMs << 6;  // convert from ms to SX126x time base
   }
 
+  // only continuous RX is shadowed as SX126X_STATUS_MODE_RX, any other RX ends on its own
+  if ( tout == SX126X_RX_NO_TIMEOUT_CONT && ChipMode == SX126X_STATUS_MODE_RX ) 
+  {
+    CmdSuppressed++;
+    return;
+  }
+
+  // in GFSK variable length mode the payload length is the longest packet RX accepts
+  if ( PacketType == SX126X_PACKET_TYPE_GFSK ) {
+    SetPayloadLength(SX126X_BUFFER_SIZE - 1);
+  }
+
+  ClearIrqStatus(SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT);
+
   uint8_t buf[3];
   buf[0] = (uint8_t)((tout >> 16) & 0xFF);
   buf[1] = (uint8_t)((tout >> 8) & 0xFF);
   buf[2] = (uint8_t )(tout & 0xFF);
-  SPIwriteCommand(SX126X_CMD_SET_RX, buf, 3);
+  uint8_t rv = SPIwriteCommand(SX126X_CMD_SET_RX, buf, 3);
+  ChipMode = (rv == ERR_NONE && tout == SX126X_RX_NO_TIMEOUT_CONT) ? SX126X_STATUS_MODE_RX : SX126X_CHIP_MODE_UNKNOWN;
+  IrqMaybeSet = SX126X_IRQ_ALL;
 }
 
 
@@ -850,6 +4024,7 @@ void SX126x::SetRx(uint32_t timeoutInMs)
 //  Parameters:
 //  0: Timeout disable, Tx Single mode, the device will stay in TX Mode until the packet is transmitted
 //  other: Timeout in milliseconds, timeout active, the device remains in TX mode. The maximum timeout is then 262 s.
+//  SX126X_TIMEOUT_AUTO is resolved by the callers (StartTx(), ReceiveMode()) before it gets here.
 //  
 //
 //
@@ -870,14 +4045,123 @@ void SX126x::SetTx(uint32_t timeoutInMs)
   buf[0] = (uint8_t)((tout >> 16) & 0xFF);
   buf[1] = (uint8_t)((tout >> 8) & 0xFF);
   buf[2] = (uint8_t) (tout & 0xFF);
-  SPIwriteCommand(SX126X_CMD_SET_TX, buf, 3);
+  ChipMode = (SPIwriteCommand(SX126X_CMD_SET_TX, buf, 3) == ERR_NONE) ? SX126X_STATUS_MODE_TX : SX126X_CHIP_MODE_UNKNOWN;
+  IrqMaybeSet = SX126X_IRQ_ALL;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  The command SetRxDutyCycle() starts the RX duty cycle: RX for rxPeriod, sleep for sleepPeriod, both in steps of
+//  15.625 us, until a preamble is detected. The periods are computed as described in ReceiveDutyCycle().
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126x::SetRxDutyCycle(uint16_t preambleLength)
+{
+  if ( PacketType != SX126X_PACKET_TYPE_LORA ) {
+    return ERR_WRONG_MODEM;
+  }
+
+  if ( preambleLength == 0 ) {
+    preambleLength = ((uint16_t)PacketParams[0] << 8) | PacketParams[1];
+  }
+
+  uint32_t symbolUs = SymbolTime();
+  if ( symbolUs == 0 || preambleLength <= 2 * SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS ) {
+    return ERR_UNSUPPORTED_MODE;
+  }
+
+  uint32_t rxUs = SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS * symbolUs;
+  uint32_t spanUs = (uint32_t)(preambleLength - 2 * SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS) * symbolUs;
+  if ( spanUs <= SX126X_RX_DUTY_CYCLE_WAKE_US ) {
+    return ERR_UNSUPPORTED_MODE;
+  }
+
+  // us to 15.625 us steps, limited to the 24 bit fields
+  uint32_t rxPeriod = (rxUs * 8 + 124) / 125;
+  uint32_t sleepPeriod = (spanUs - SX126X_RX_DUTY_CYCLE_WAKE_US) * 8 / 125;
+  if ( rxPeriod > 0xFFFFFF ) {
+    rxPeriod = 0xFFFFFF;
+  }
+  if ( sleepPeriod > 0xFFFFFF ) {
+    sleepPeriod = 0xFFFFFF;
+  }
+
+  SetStandby(SX126X_STANDBY_RC);
+  ClearIrqStatus(SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT);
+
+  uint8_t buf[6];
+  buf[0] = (uint8_t)((rxPeriod >> 16) & 0xFF);
+  buf[1] = (uint8_t)((rxPeriod >> 8) & 0xFF);
+  buf[2] = (uint8_t)(rxPeriod & 0xFF);
+  buf[3] = (uint8_t)((sleepPeriod >> 16) & 0xFF);
+  buf[4] = (uint8_t)((sleepPeriod >> 8) & 0xFF);
+  buf[5] = (uint8_t)(sleepPeriod & 0xFF);
+  uint8_t rv = SPIwriteCommand(SX126X_CMD_SET_RX_DUTY_CYCLE, buf, 6);
+  ChipMode = (rv == ERR_NONE) ? SX126X_CHIP_MODE_RX_DUTY_CYCLE : SX126X_CHIP_MODE_UNKNOWN;
+  IrqMaybeSet = SX126X_IRQ_ALL;
+
+  return rv;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  The command SetCad() runs one channel activity detection over CadSymbolNum symbols with the thresholds set by
+//  SetCadThresholds(). CAD_DONE is raised when it ends, with CAD_DETECTED if LoRa activity was found.
+//
+//  Parameters:
+//  exitMode - SX126X_CAD_GOTO_STDBY: always return to STDBY_RC
+//             SX126X_CAD_GOTO_RX: on detection stay in RX for a packet, timeout steps of 15.625 us
+//  timeout  - RX timeout after a detection with SX126X_CAD_GOTO_RX
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126x::SetCad(uint8_t exitMode, uint32_t timeout)
+{
+  SetStandby(SX126X_STANDBY_RC);
+
+  uint8_t buf[7];
+  buf[0] = CadSymbolNum;
+  buf[1] = (CadDetPeak != 0) ? CadDetPeak : SX126xCadDetPeak(ModulationParams[0]);
+  buf[2] = CadDetMin;
+  buf[3] = exitMode;
+  buf[4] = (uint8_t)((timeout >> 16) & 0xFF);
+  buf[5] = (uint8_t)((timeout >> 8) & 0xFF);
+  buf[6] = (uint8_t)(timeout & 0xFF);
+  SPIwriteCommand(SX126X_CMD_SET_CAD_PARAMS, buf, 7);
+
+  ClearIrqStatus(SX126X_IRQ_CAD_DONE | SX126X_IRQ_CAD_DETECTED | SX126X_IRQ_RX_DONE | SX126X_IRQ_TIMEOUT);
+  ChipMode = (SPIwriteCommand(SX126X_CMD_SET_CAD, buf, 0) == ERR_NONE) ? SX126X_CHIP_MODE_CAD : SX126X_CHIP_MODE_UNKNOWN;
+  IrqMaybeSet = SX126X_IRQ_ALL;
+}
+
+
+// LoRa symbol time in us, 0 if the modulation is not configured
+uint32_t SX126x::SymbolTime(void)
+{
+  uint32_t bandwidth = SX126xLoRaBandwidthHz(ModulationParams[1]);
+  if ( bandwidth == 0 ) {
+    return 0;
+  }
+  return ((uint32_t)1 << ModulationParams[0]) * 1000000UL / bandwidth;
+}
+
+
+// RX timeout after a CAD detection in 15.625 us steps: the rest of the preamble, the sync word and the header
+uint32_t SX126x::CadRxTimeout(void)
+{
+  uint32_t preamble = ((uint16_t)PacketParams[0] << 8) | PacketParams[1];
+  uint32_t timeout = (preamble + SX126X_CAD_RX_TIMEOUT_SYMBOLS) * SymbolTime() * 8 / 125;
+  return (timeout > 0xFFFFFF) ? 0xFFFFFF : timeout;
 }
 
 
 void SX126x::SetFs(void) 
 {
+  if ( ChipMode == SX126X_STATUS_MODE_FS ) 
+  {
+    CmdSuppressed++;
+    return;
+  }
+
   uint8_t buf = 0;
-  SPIwriteCommand(SX126X_CMD_SET_FS, &buf, 0);
+  ChipMode = (SPIwriteCommand(SX126X_CMD_SET_FS, &buf, 0) == ERR_NONE) ? SX126X_STATUS_MODE_FS : SX126X_CHIP_MODE_UNKNOWN;
 }
 
 
@@ -894,7 +4178,7 @@ void SX126x::SetFs(void)
 //----------------------------------------------------------------------------------------------------------------------------
 void SX126x::GetRxBufferStatus(uint8_t *payloadLength, uint8_t *rxStartBufferPointer)
 {
-    uint8_t buf[2];
+    uint8_t buf[2] = { 0, 0 };
 
     SPIreadCommand( SX126X_CMD_GET_RX_BUFFER_STATUS, buf, 2 );
 	
@@ -930,25 +4214,38 @@ uint8_t SX126x::ReadBuffer(uint8_t *rxData, uint16_t *rxDataLen)
     *rxDataLen = packetLen;
   }
 
-  while(digitalRead(SX126x_BUSY));
-  
-  digitalWrite(SX126x_SPI_SELECT, LOW);
-  SPI.beginTransaction(SX126X_SPI_SETTINGS);
-  SPI.transfer(SX126X_CMD_READ_BUFFER);
-  SPI.transfer(offset);
-  SPI.transfer(SX126X_CMD_NOP);
-  for( uint8_t i = 0; i < *rxDataLen; i++ )
-  {
-    rxData[i] = SPI.transfer(SX126X_CMD_NOP);
+  if ( ReadBufferAt(offset, rxData, *rxDataLen) != ERR_NONE ) {
+    rv = ERR_BUSY_TIMEOUT;
   }
-  digitalWrite(SX126x_SPI_SELECT, HIGH);
-  
-  while(digitalRead(SX126x_BUSY));
 
   return rv;
 }
 
 
+// reads len bytes from the chip's data buffer starting at offset
+uint8_t SX126x::ReadBufferAt(uint8_t offset, uint8_t *rxData, uint16_t len)
+{
+  if ( WaitOnBusy() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+  
+  Hal->SpiBegin();
+  Hal->SpiTransfer(SX126X_CMD_READ_BUFFER);
+  Hal->SpiTransfer(offset);
+  Hal->SpiTransfer(SX126X_CMD_NOP);
+  uint32_t start = Hal->Micros();
+  Hal->SpiTransferBlock(NULL, rxData, len);
+  SpiBlockMicros += Hal->Micros() - start;
+  SpiBlockBytes += len;
+  Hal->SpiEnd();
+#if SX126X_STATS
+  Stats.spiBytes += 3 + len;
+#endif
+  
+  return WaitOnBusy();
+}
+
+
 //----------------------------------------------------------------------------------------------------------------------------
 //  The command...
 //
@@ -960,89 +4257,176 @@ uint8_t SX126x::ReadBuffer(uint8_t *rxData, uint16_t *rxDataLen)
 //  none
 //  
 //----------------------------------------------------------------------------------------------------------------------------
-uint8_t SX126x::WriteBuffer(uint8_t *txData, uint16_t txDataLen)
+uint8_t SX126x::WriteBuffer(uint8_t *txData, uint16_t txDataLen, const uint8_t *header, uint8_t headerLen)
 {
   uint8_t rv = ERR_NONE;
 
-  if (txDataLen > SX126X_BUFFER_SIZE) {
+  if (headerLen + txDataLen > SX126X_BUFFER_SIZE) {
     rv = ERR_PACKET_TOO_LONG;
+    txDataLen = SX126X_BUFFER_SIZE - headerLen;
   }
 
-  digitalWrite(SX126x_SPI_SELECT, LOW);
-  SPI.beginTransaction(SX126X_SPI_SETTINGS);
-  SPI.transfer(SX126X_CMD_WRITE_BUFFER);
-  SPI.transfer(0); //offset in tx fifo
-  for( uint16_t i = 0; i < txDataLen; i++ )
-  {
-      SPI.transfer(txData[i]);  
+  if ( WakeIfAsleep() != ERR_NONE || WaitOnBusy() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+
+  Hal->SpiBegin();
+  Hal->SpiTransfer(SX126X_CMD_WRITE_BUFFER);
+  Hal->SpiTransfer(0); //offset in tx fifo
+  uint32_t start = Hal->Micros();
+  // a header is clocked in the same transaction, so the payload never has to be copied behind it
+  if ( headerLen > 0 ) {
+    Hal->SpiTransferBlock(header, NULL, headerLen);
   }
-  digitalWrite(SX126x_SPI_SELECT, HIGH);
+  Hal->SpiTransferBlock(txData, NULL, txDataLen);
+  SpiBlockMicros += Hal->Micros() - start;
+  SpiBlockBytes += headerLen + txDataLen;
+  Hal->SpiEnd();
+#if SX126X_STATS
+  Stats.spiBytes += 2 + headerLen + txDataLen;
+#endif
+
+  if ( WaitOnBusy() != ERR_NONE ) {
+    rv = ERR_BUSY_TIMEOUT;
+  }
+
+  return rv;
+}
 
-  while(digitalRead(SX126x_BUSY));
 
+uint8_t SX126x::SPIwriteCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy) {
+  if ( WakeIfAsleep() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+  if ( ShadowMatches(cmd, data, numBytes) ) 
+  {
+    CmdSuppressed++;
+    return ERR_NONE;
+  }
+
+  uint8_t rv = SPItransfer(cmd, true, data, NULL, numBytes, waitForBusy);
+  if ( rv != ERR_NONE ) {
+    InvalidateShadowSlot(cmd);
+  }
   return rv;
 }
 
 
-void SX126x::SPIwriteCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy) {
-  SPItransfer(cmd, true, data, NULL, numBytes, waitForBusy);
+//----------------------------------------------------------------------------------------------------------------------------
+//  Compares a configuration command with the parameters it was last sent with and records the new ones. Commands that
+//  are not in SX126X_SHADOWED_COMMANDS never match.
+//
+//  Return value:
+//  true if the command would not change the chip state and can be skipped
+//----------------------------------------------------------------------------------------------------------------------------
+bool SX126x::ShadowMatches(uint8_t cmd, uint8_t* data, uint8_t numBytes)
+{
+  for ( uint8_t i = 0; i < SX126X_SHADOW_SLOTS; i++ )
+  {
+    if ( SX126X_SHADOWED_COMMANDS[i] != cmd ) {
+      continue;
+    }
+
+    uint8_t* shadow = ShadowParams[i];
+    if ( shadow[0] == numBytes && memcmp(&shadow[1], data, numBytes) == 0 ) {
+      return true;
+    }
+
+    if ( numBytes <= SX126X_SHADOW_MAX_PARAMS ) 
+    {
+      shadow[0] = numBytes;
+      memcpy(&shadow[1], data, numBytes);
+    }
+    else {
+      shadow[0] = 0xFF;
+    }
+
+    // changing the packet type resets the modem parameters, SetPaConfig() resets the OCP register
+    if ( cmd == SX126X_CMD_SET_PACKET_TYPE ) 
+    {
+      InvalidateShadowSlot(SX126X_CMD_SET_MODULATION_PARAMS);
+      InvalidateShadowSlot(SX126X_CMD_SET_PACKET_PARAMS);
+    }
+    else if ( cmd == SX126X_CMD_SET_PA_CONFIG ) {
+      InvalidateShadowSlot(SX126X_CMD_WRITE_REGISTER);
+    }
+    return false;
+  }
+
+  return false;
+}
+
+
+void SX126x::InvalidateShadowSlot(uint8_t cmd)
+{
+  for ( uint8_t i = 0; i < SX126X_SHADOW_SLOTS; i++ )
+  {
+    if ( SX126X_SHADOWED_COMMANDS[i] == cmd ) {
+      ShadowParams[i][0] = 0xFF;
+    }
+  }
+}
+
+
+// forgets everything known about the chip, used after a reset
+void SX126x::InvalidateShadow(void)
+{
+  for ( uint8_t i = 0; i < SX126X_SHADOW_SLOTS; i++ ) {
+    ShadowParams[i][0] = 0xFF;
+  }
+  ShadowStale = false;
+  ChipMode = SX126X_CHIP_MODE_UNKNOWN;
+  IrqMaybeSet = SX126X_IRQ_ALL;
 }
 
 
-void SX126x::SPIreadCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy) {
-  SPItransfer(cmd, false, NULL, data, numBytes, waitForBusy);
+uint8_t SX126x::SPIreadCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy) {
+  return SPItransfer(cmd, false, NULL, data, numBytes, waitForBusy);
 }
 
 
-void SX126x::SPItransfer(uint8_t cmd, bool write, uint8_t* dataOut, uint8_t* dataIn, uint8_t numBytes, bool waitForBusy) {
+uint8_t SX126x::SPItransfer(uint8_t cmd, bool write, uint8_t* dataOut, uint8_t* dataIn, uint8_t numBytes, bool waitForBusy) {
   
-  // ensure BUSY is low (state meachine ready)
-  // TODO timeout
-  while(digitalRead(SX126x_BUSY));
+  // BUSY stays high while the chip sleeps
+  if ( WakeIfAsleep() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+
+  // ensure BUSY is low (state meachine ready), a command clocked into a busy chip is lost
+  if ( WaitOnBusy() != ERR_NONE ) {
+    return ERR_BUSY_TIMEOUT;
+  }
+
+  CmdIssued++;
 
   // start transfer
-  digitalWrite(SX126x_SPI_SELECT, LOW);
-  SPI.beginTransaction(SX126X_SPI_SETTINGS);
+  Hal->SpiBegin();
 
   // send command byte
-  SPI.transfer(cmd);
+  Hal->SpiTransfer(cmd);
 
   // send/receive all bytes
   if(write) {
-    // Serial.print("SPI write: CMD=0x");
-    // Serial.print(cmd, HEX);
-    // Serial.print(" DataOut: ");
-    for(uint8_t n = 0; n < numBytes; n++) {
-      uint8_t in = SPI.transfer(dataOut[n]);
-      // Serial.print(dataOut[n], HEX);
-      // Serial.print(" ");
-    }
-    //Serial.println();
+    Hal->SpiTransferBlock(dataOut, NULL, numBytes);
   } else {
-    // Serial.print("SPI read:  CMD=0x");
-    // Serial.print(cmd, HEX);
     // skip the first byte for read-type commands (status-only)
-    uint8_t in = SPI.transfer(SX126X_CMD_NOP);
-    // Serial.println((SX126X_CMD_NOP, HEX));
-    // Serial.print(" DataIn: ");
-
-    for(uint8_t n = 0; n < numBytes; n++) {
-      dataIn[n] = SPI.transfer(SX126X_CMD_NOP);
-      // Serial.println((SX126X_CMD_NOP, HEX));
-      // Serial.print(dataIn[n], HEX);
-      // Serial.print(" ");
-    }
-    // Serial.println();
+    Hal->SpiTransfer(SX126X_CMD_NOP);
+    Hal->SpiTransferBlock(NULL, dataIn, numBytes);
   }
 
   // stop transfer
-  SPI.endTransaction();
-  digitalWrite(SX126x_SPI_SELECT, HIGH);
+  Hal->SpiEnd();
+
+#if SX126X_STATS
+  Stats.spiBytes += write ? 1 + numBytes : 2 + numBytes;
+#endif
 
   // wait for BUSY to go high and then low
-  // TODO timeout
+  // a configuration sequence polls BUSY itself
   if(waitForBusy) {
-    delayMicroseconds(1);
-    while(digitalRead(SX126x_BUSY));
+    Hal->DelayMicroseconds(1);
+    return SeqIssuing ? ERR_NONE : WaitOnBusy();
   }
+
+  return ERR_NONE;
 }
\ No newline at end of file
@@ -1,8 +1,16 @@
 #ifndef _SX126X_H
 #define _SX126X_H
 
+#ifdef ARDUINO
 #include "Arduino.h"
 #include <SPI.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#include "SX126xHal.h"
 
 //return values
 #define ERR_NONE                            0
@@ -25,11 +33,16 @@
 #define ERR_DEVICE_BUSY                     17
 #define ERR_UNSUPPORTED_MODE                18
 #define ERR_CALIBRATION_FAILED              19
+#define ERR_DUTY_CYCLE                      20
+#define ERR_CHANNEL_BUSY                    21
+#define ERR_BUSY_TIMEOUT                    22
+#define ERR_STREAM_INCOMPLETE               23
+#define ERR_NO_ACK                          24
+#define ERR_INVALID_PREAMBLE_LENGTH         25
+#define ERR_INVALID_CRC_TYPE                26
+#define ERR_INVALID_ADDRESS_FILTER          27
 
 // SX126X physical layer properties
-#define SX126X_XTAL_FREQ                    ( double )32000000
-#define SX126X_FREQ_DIV                     ( double )pow( 2.0, 25.0 )
-#define SX126X_FREQ_STEP                    ( double )( SX126X_XTAL_FREQ / SX126X_FREQ_DIV )
 #define SX126X_BUFFER_SIZE                  256
 
 // SX126X SPI commands
@@ -132,6 +145,10 @@
 //SX126X_CMD_SET_RX
 #define SX126X_RX_NO_TIMEOUT_SINGLE                   0x000000    //  23    0     Rx timeout duration: no timeout (Rx single mode)
 #define SX126X_RX_NO_TIMEOUT_CONT                     0xFFFFFF    //  23    0                          infinite (Rx continuous mode)
+#define SX126X_TIMEOUT_AUTO                           0xFFFFFFFE  //  timeoutInMs derived from the time on air, see GetTimeOnAir()
+#ifndef SX126X_TIMEOUT_AUTO_MARGIN_MS
+#define SX126X_TIMEOUT_AUTO_MARGIN_MS                 2           //  added to the time on air for SX126X_TIMEOUT_AUTO
+#endif
 
 //SX126X_CMD_STOP_TIMER_ON_PREAMBLE
 #define SX126X_STOP_ON_PREAMBLE_OFF                   0x00        //  7     0     stop timer on: sync word or header (default)
@@ -262,6 +279,7 @@
 #define SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_OFF        0x00        //  7     0     LoRa low data rate optimization: disabled
 #define SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_ON         0x01        //  7     0                                      enabled
 #define SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_THRESH     0.01638     //  ldro is recommended with at or above 16.38ms symbol times
+#define SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_THRESH_10US 1638       //  same threshold in units of 10 us for integer math
 
 //SX126X_CMD_SET_PACKET_PARAMS
 #define SX126X_GFSK_PREAMBLE_DETECT_OFF               0x00        //  7     0     GFSK minimum preamble length before reception starts: detector disabled
@@ -281,6 +299,18 @@
 #define SX126X_GFSK_CRC_2_BYTE_INV                    0x06        //  7     0                      2 byte, inverted
 #define SX126X_GFSK_WHITENING_OFF                     0x00        //  7     0     GFSK data whitening: disabled
 #define SX126X_GFSK_WHITENING_ON                      0x01        //  7     0                          enabled
+#define SX126X_GFSK_BIT_RATE_MIN                      600         //                GFSK bit rate limits in bps
+#define SX126X_GFSK_BIT_RATE_MAX                      300000
+#define SX126X_GFSK_FREQUENCY_DEVIATION_MAX           200000      //                GFSK frequency deviation limit in Hz
+#define SX126X_GFSK_SYNC_WORD_MAX                     8           //                GFSK sync word length limit in bytes
+#define SX126X_GFSK_CRC_2_BYTE_INITIAL                0x1D0F      //                GFSK CRC seed and polynomial: 2 byte (CCITT)
+#define SX126X_GFSK_CRC_2_BYTE_POLYNOMIAL             0x1021
+#define SX126X_GFSK_CRC_1_BYTE_INITIAL                0x00FF      //                                              1 byte
+#define SX126X_GFSK_CRC_1_BYTE_POLYNOMIAL             0x0007
+#define SX126X_LORA_PACKET_PARAMS                     6           //                SetPacketParams length and payload length index: LoRa
+#define SX126X_LORA_PAYLOAD_LENGTH_PARAM              3
+#define SX126X_GFSK_PACKET_PARAMS                     9           //                                                                 GFSK
+#define SX126X_GFSK_PAYLOAD_LENGTH_PARAM              6
 #define SX126X_LORA_HEADER_EXPLICIT                   0x00        //  7     0     LoRa header mode: explicit (Variable length packets)
 #define SX126X_LORA_HEADER_IMPLICIT                   0x01        //  7     0                       implicit (Fixed length packets)
 #define SX126X_LORA_CRC_OFF                           0x00        //  7     0     LoRa CRC mode: disabled
@@ -341,63 +371,627 @@
 #define SX126X_DEFAULT_MODE_FS                        0x03        // Return to Frequency Synthesis
 #define SX126X_DEFAULT_MODE_RX_CONTINUOUS             0x04        // Return to Continuous RX
 #define SX126X_DEFAULT_MODE_RX_SINGLE                 0x05        // Return to RX Single packet then return to STBY_RC
+#define SX126X_DEFAULT_MODE_SLEEP_WARM                0x06        // Return to Sleep, configuration retained
+#define SX126X_DEFAULT_MODE_SLEEP_COLD                0x07        // Return to Sleep, configuration restored by the driver on wake
+#define SX126X_DEFAULT_MODE_SLEEP_WARM_RTC            0x08        // Return to Sleep with wake up on the RTC, configuration retained
+#define SX126X_DEFAULT_MODE_RX_DUTY_CYCLE             0x09        // Return to RX duty cycle (sniff), see ReceiveDutyCycle()
+#define SX126X_DEFAULT_MODE_CAD_RX                    0x0A        // Return to CAD, RX when activity is detected, see ReceiveCad()
+
+//SX126X DIO1 SERVICE MODE                                        // Where the SPI work triggered by DIO1 is done
+#define SX126X_SERVICE_MODE_ISR                       0x00        // Inside the DIO1 interrupt (default)
+#define SX126X_SERVICE_MODE_DEFERRED                  0x01        // In Service(), the interrupt only records the event
+
+//SX126X driver buffers
+#ifndef SX126X_RX_RING_SLOTS
+#define SX126X_RX_RING_SLOTS                          2           // received packets held between the DIO1 interrupt and the application
+#endif
+#ifndef SX126X_MAX_INSTANCES
+#define SX126X_MAX_INSTANCES                          2           // radios with their own DIO1 interrupt on one host
+#endif
+#define SX126X_NO_INSTANCE                            0xFF
+#ifndef SX126X_DUTY_CYCLE_BANDS
+#define SX126X_DUTY_CYCLE_BANDS                       4           // sub-bands with their own airtime budget
+#endif
+#define SX126X_NO_BAND                                0xFF
+#define SX126X_SHADOW_SLOTS                           16          // commands in the shadow cache, see SPIwriteCommand()
+#define SX126X_SHADOW_MAX_PARAMS                      9
+#define SX126X_CHIP_MODE_UNKNOWN                      0x00        // shadowed chip mode after reset or a RX that ends on its own
+#define SX126X_CHIP_MODE_SLEEP                        0x10        // shadowed chip mode while sleeping (not reported by GetStatus)
+#define SX126X_CHIP_MODE_RX_DUTY_CYCLE                0x11        // shadowed chip mode while sniffing
+#define SX126X_CHIP_MODE_CAD                          0x12        // shadowed chip mode during channel activity detection
+#ifndef SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS
+#define SX126X_RX_DUTY_CYCLE_DETECT_SYMBOLS           6           // preamble symbols a RX window needs to detect a packet
+#endif
+#ifndef SX126X_RX_DUTY_CYCLE_WAKE_US
+#define SX126X_RX_DUTY_CYCLE_WAKE_US                  1000        // sleep to RX start up time of each window
+#endif
+#ifndef SX126X_BUSY_TIMEOUT_US
+#define SX126X_BUSY_TIMEOUT_US                        20000       // longest BUSY wait, covers TCXO start up and a full calibration
+#endif
+#ifndef SX126X_SLEEP_SETTLE_US
+#define SX126X_SLEEP_SETTLE_US                        500         // least time between SetSleep and the NSS edge that wakes the chip
+#endif
+#ifndef SX126X_LBT_MAX_BACKOFF_EXPONENT
+#define SX126X_LBT_MAX_BACKOFF_EXPONENT               5           // listen before talk backs off at most 2^5 slots
+#endif
+#ifndef SX126X_CAD_DET_MIN
+#define SX126X_CAD_DET_MIN                            10          // default minimum CAD peak, see SetCadThresholds()
+#endif
+#ifndef SX126X_CAD_RX_TIMEOUT_SYMBOLS
+#define SX126X_CAD_RX_TIMEOUT_SYMBOLS                 16          // symbols past the preamble RX waits for a header after a CAD
+#endif
+#define SX126X_RETAINED_MAGIC                         0x53583132  // "SX12", marks a valid SX126xRetainedConfig
+#ifndef SX126X_TX_QUEUE_DEPTH
+#define SX126X_TX_QUEUE_DEPTH                         4           // frames waiting for the radio in SendQueued()
+#endif
+// Frames the driver sends on its own are told apart by their first byte, SX126X_RESERVED_FIRST to SX126X_RESERVED_LAST.
+// Only with SetProtocolFraming(true) do Send(), SendAsync() and SendQueued() put SX126X_ESCAPE_MARKER in front of an
+// application frame that starts with one of these bytes, and the receiver takes it off again. Such a frame is then one
+// byte longer on air and at most 254 bytes long. Without framing, frames go on air as they are.
+#define SX126X_RESERVED_FIRST                         0xF4        // first reserved value of the first byte of a frame
+#define SX126X_RESERVED_LAST                          0xF8        // last reserved value of the first byte of a frame
+#define SX126X_ESCAPE_MARKER                          0xF4        // in front of an application frame that starts with a reserved byte
+#define SX126X_STREAM_MARKER                          0xF5        // first byte of a stream fragment, see StreamSend()
+#define SX126X_STREAM_HEADER_SIZE                     7           // marker, transfer ID, fragment index (2), fragment count (2), fragment size
+#define SX126X_RX_PEEK_SIZE                           7           // leading bytes of a frame read to find its protocol, the longest header
+#ifndef SX126X_STREAM_FRAGMENT_SIZE
+#define SX126X_STREAM_FRAGMENT_SIZE                   248         // payload bytes per fragment, at most 255 - SX126X_STREAM_HEADER_SIZE
+#endif
+#if SX126X_STREAM_FRAGMENT_SIZE + SX126X_STREAM_HEADER_SIZE > 255
+#error "SX126X_STREAM_FRAGMENT_SIZE does not fit in a frame"
+#endif
+#define SX126X_ARQ_DATA_MARKER                        0xF6        // first byte of a ReliableSend() frame
+#define SX126X_ARQ_ACK_MARKER                         0xF7        // first byte of an acknowledgement
+#define SX126X_ARQ_HEADER_SIZE                        5           // marker, session, sender window base, sequence number, flags
+#define SX126X_ARQ_ACK_SIZE                           5           // marker, session, next expected sequence number, bitmap (2)
+#define SX126X_ARQ_FLAG_ACK_REQUEST                   0x01        // last frame of a burst, the receiver answers it
+#ifndef SX126X_ARQ_WINDOW
+#define SX126X_ARQ_WINDOW                             8           // frames in flight, a power of two up to 16
+#endif
+#if SX126X_ARQ_WINDOW > 16 || (SX126X_ARQ_WINDOW & (SX126X_ARQ_WINDOW - 1)) != 0
+#error "SX126X_ARQ_WINDOW must be a power of two that fits in the acknowledgement bitmap"
+#endif
+#ifndef SX126X_ARQ_MAX_RETRIES
+#define SX126X_ARQ_MAX_RETRIES                        5           // retransmissions before a frame is reported with ERR_NO_ACK
+#endif
+#ifndef SX126X_ARQ_TURNAROUND_US
+#define SX126X_ARQ_TURNAROUND_US                      20000       // added to the acknowledgement's time on air for the ACK timeout
+#endif
+#define SX126X_LINK_MARKER                            0xF8        // first byte of a link adaptation frame
+#define SX126X_LINK_FRAME_SIZE                        5           // marker, type, rate index, sender's margin and power headroom in dB
+#define SX126X_LINK_REPORT                            0x00        // link frame: margin report, see LinkReport()
+#define SX126X_LINK_SWITCH                            0x01        // link frame: request to switch to the rate index
+#define SX126X_LINK_SWITCH_ACK                        0x02        // link frame: switch accepted, its sender switches after it
+#define SX126X_LINK_CONFIRM                           0x03        // link frame: first frame on the new rate
+#define SX126X_LINK_NO_MARGIN                         -128        // margin not measured yet
+#ifndef SX126X_LINK_HYSTERESIS_DB
+#define SX126X_LINK_HYSTERESIS_DB                     3           // extra margin before a faster rate or a lower power is chosen
+#endif
+#ifndef SX126X_LINK_SWITCH_RETRIES
+#define SX126X_LINK_SWITCH_RETRIES                    3           // switch requests sent before a switch is given up
+#endif
+#ifndef SX126X_LINK_TURNAROUND_US
+#define SX126X_LINK_TURNAROUND_US                     20000       // added to the time on air of the awaited link frame for its timeout
+#endif
+#ifndef SX126X_LINK_SILENCE_MS
+#define SX126X_LINK_SILENCE_MS                        60000       // nothing received for this long: back to the most robust rate, 0 = never
+#endif
+#define SX126X_HOP_MANUAL                             0x00        // HopBegin(): the channel only changes with HopTo()
+#define SX126X_HOP_AFTER_TX                           0x01        // HopBegin(): next channel after every frame sent
+#define SX126X_HOP_AFTER_RX                           0x02        // HopBegin(): next channel after every frame received
+#ifndef SX126X_STATS
+#define SX126X_STATS                                  1           // 0 compiles out the SPI, ISR and packet counters of GetStats()
+#endif
 
 //SX126X LORA Bandwidths
-const uint32_t SX126X_LORA_BANDWIDTHS[11] = { 7810, 15630, 31250, 62500, 125000, 250000, 500000, 0, 10420, 20830, 416700 };
+constexpr uint32_t SX126X_LORA_BANDWIDTHS[11] = { 7810, 15630, 31250, 62500, 125000, 250000, 500000, 0, 10420, 20830, 41670 };
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Integer modulation math. These are constexpr so a profile built from constants is folded by the compiler, and they only
+//  use integer operations so evaluating them at runtime does not pull in float or double code on FPU-less MCUs.
+//----------------------------------------------------------------------------------------------------------------------------
+
+// bandwidth in Hz of a SX126X_LORA_BW_* code, 0 for an invalid code
+constexpr uint32_t SX126xLoRaBandwidthHz(uint8_t bandwidth)
+{
+  return (bandwidth < 11) ? SX126X_LORA_BANDWIDTHS[bandwidth] : 0;
+}
+
+// low data rate optimization is turned on when a symbol (2^SF / BW) lasts longer than 16.38 ms
+constexpr uint8_t SX126xLoRaLowDataRateOptimize(uint8_t spreadingFactor, uint8_t bandwidth)
+{
+  return (((uint32_t)1 << spreadingFactor) * 100000UL > SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_THRESH_10US * SX126xLoRaBandwidthHz(bandwidth))
+           ? SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_ON
+           : SX126X_LORA_LOW_DATA_RATE_OPTIMIZE_OFF;
+}
+
+// CAD detection peak recommended by Semtech (AN1200.48) for 2 CAD symbols; the ratio above which a symbol correlation
+// counts as LoRa activity, higher is less sensitive
+constexpr uint8_t SX126xCadDetPeak(uint8_t spreadingFactor)
+{
+  return (spreadingFactor <= 8) ? 22 : (spreadingFactor >= 12) ? 28 : (uint8_t)(spreadingFactor + 14);
+}
+
+// GFSK bit rate word: 32 * Fxtal / bit rate
+constexpr uint32_t SX126xGfskBitRateWord(uint32_t bitRate)
+{
+  return (bitRate != 0) ? 1024000000UL / bitRate : 0;
+}
+
+// 10 * log10 of the bandwidth in Hz of each SX126X_LORA_BW_* code, dB * 4
+constexpr int16_t SX126X_LORA_BANDWIDTHS_QDB[11] = { 156, 168, 180, 192, 204, 216, 228, 0, 161, 173, 185 };
+
+// lowest SNR a LoRa packet can be demodulated at: -2.5 dB at SF5, 2.5 dB lower per SF step; dB * 4
+constexpr int16_t SX126xLoRaSnrFloor(uint8_t spreadingFactor)
+{
+  return -10 * ((int16_t)spreadingFactor - 4);
+}
+
+// noise floor of the receiver: thermal noise of -174 dBm/Hz over the bandwidth plus a 6 dB noise figure; dBm * 4
+constexpr int16_t SX126xLoRaNoiseFloor(uint8_t bandwidth)
+{
+  return (-174 + 6) * 4 + ((bandwidth < 11) ? SX126X_LORA_BANDWIDTHS_QDB[bandwidth] : 0);
+}
+
+// sensitivity: noise floor plus demodulation floor; dBm * 4
+constexpr int16_t SX126xLoRaSensitivity(uint8_t spreadingFactor, uint8_t bandwidth)
+{
+  return SX126xLoRaNoiseFloor(bandwidth) + SX126xLoRaSnrFloor(spreadingFactor);
+}
+
+// CalibrateImage() band of a frequency, the two command bytes MSB first
+constexpr uint16_t SX126xImageCalibration(uint32_t frequencyInHz)
+{
+  return (frequencyInHz > 900000000) ? (SX126X_CAL_IMG_902_MHZ_1 << 8 | SX126X_CAL_IMG_902_MHZ_2) :
+         (frequencyInHz > 850000000) ? (SX126X_CAL_IMG_863_MHZ_1 << 8 | SX126X_CAL_IMG_863_MHZ_2) :
+         (frequencyInHz > 770000000) ? (SX126X_CAL_IMG_779_MHZ_1 << 8 | SX126X_CAL_IMG_779_MHZ_2) :
+         (frequencyInHz > 460000000) ? (SX126X_CAL_IMG_470_MHZ_1 << 8 | SX126X_CAL_IMG_470_MHZ_2) :
+                                       (SX126X_CAL_IMG_430_MHZ_1 << 8 | SX126X_CAL_IMG_430_MHZ_2);
+}
+
+// RF frequency word: f * 2^25 / 32 MHz, which reduces to f * 2^14 / 15625. Splitting f by 15625 keeps every
+// intermediate value below 2^32.
+constexpr uint32_t SX126xFrequencyWord(uint32_t frequencyInHz)
+{
+  return ((frequencyInHz / 15625UL) << 14) + (((frequencyInHz % 15625UL) << 14) / 15625UL);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Complete LoRa configuration: the modulation, packet and frequency command parameters exactly as they are sent to the
+//  chip, with the low data rate optimization already decided. Declared constexpr the whole profile is computed at compile
+//  time; built at runtime it costs a few integer operations.
+//
+//    constexpr SX126xLoRaProfile profile(915000000, 7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8,
+//                                        SX126X_LORA_HEADER_EXPLICIT, true, false);
+//    lora.LoRaBegin(profile);
+//
+//  The arguments match LoRaBegin(). A frequency of 0 leaves the RF frequency set by ModuleConfig() untouched.
+//----------------------------------------------------------------------------------------------------------------------------
+struct SX126xLoRaProfile {
+  uint32_t  frequencyInHz;
+  uint8_t   modulationParams[4];   // SF, BW, CR, LDRO
+  uint8_t   packetParams[6];       // preamble (2), header mode, payload length, CRC, IQ
+  uint8_t   rfFrequency[4];        // frequency word, MSB first
+
+  constexpr SX126xLoRaProfile(uint32_t frequencyInHz, uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate,
+                              uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq)
+    : frequencyInHz(frequencyInHz),
+      modulationParams{ spreadingFactor, bandwidth, codingRate, SX126xLoRaLowDataRateOptimize(spreadingFactor, bandwidth) },
+      packetParams{ (uint8_t)(preambleLength >> 8), (uint8_t)preambleLength, headerMode, (uint8_t)(SX126X_BUFFER_SIZE - 1),
+                    (uint8_t)(crcOn ? SX126X_LORA_CRC_ON : SX126X_LORA_CRC_OFF),
+                    (uint8_t)(invertIrq ? SX126X_LORA_IQ_STANDARD : SX126X_LORA_IQ_INVERTED) },
+      rfFrequency{ (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 24), (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 16),
+                   (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 8),  (uint8_t)SX126xFrequencyWord(frequencyInHz) }
+  {
+  }
+};
+
+
+// Airtime budget of one regulatory sub-band, see SetDutyCycleBand()
+struct SX126xDutyCycleBand {
+  uint32_t  minHz;
+  uint32_t  maxHz;
+  uint16_t  divisor;            // allowed airtime is 1/divisor of the elapsed time, 0 = entry unused
+  uint32_t  maxCreditUs;        // largest burst of airtime that can be saved up
+  int32_t   creditUs;           // airtime available now
+  uint32_t  lastMs;             // millis() of the last refill
+};
+
+
+// Host side record of the radio configuration, written by Sleep() and used by WarmStart(). Keep it in memory that
+// survives the host's own sleep (e.g. RTC_DATA_ATTR on ESP32).
+struct SX126xRetainedConfig {
+  uint32_t  magic;
+  uint8_t   packetType;
+  uint8_t   defaultMode;
+  uint32_t  rfFrequency;
+  uint8_t   modulationParams[8];
+  uint8_t   packetParams[9];
+  uint8_t   gfskRegisters[SX126X_GFSK_SYNC_WORD_MAX + 2];
+  uint8_t   shadowParams[SX126X_SHADOW_SLOTS][SX126X_SHADOW_MAX_PARAMS + 1];
+};
+
+
+// Link quality of the last received packet, see GetPacketStatus(). Levels are fixed point with 2 fractional bits
+// (1/4 dB steps), divide by 4 or use SX126xQuarterDbToDb() for whole dB.
+struct SX126xPacketStatus {
+  int16_t   rssi;               // average RSSI over the packet, dBm * 4
+  int16_t   signalRssi;         // LoRa: RSSI of the despread signal, GFSK: RSSI at the sync word; dBm * 4
+  int16_t   snr;                // LoRa SNR, dB * 4; 0 in GFSK
+  uint8_t   rxStatus;           // GFSK SX126X_GFSK_RX_STATUS_* bits, 0 in LoRa
+};
+
+
+// rounds a SX126xPacketStatus level to whole dB, halves away from zero
+constexpr int8_t SX126xQuarterDbToDb(int16_t quarterDb)
+{
+  return (int8_t)((quarterDb < 0) ? -((-quarterDb + 2) / 4) : (quarterDb + 2) / 4);
+}
+
+
+// Received packet as stored in the driver's RX ring
+struct SX126xRxPacket {
+  uint8_t   data[SX126X_BUFFER_SIZE];
+  uint16_t  len;
+  uint16_t  irq;                // IRQ status the packet was received with
+  uint8_t   status;             // ERR_NONE, ERR_CRC_MISMATCH or ERR_PACKET_TOO_LONG
+  SX126xPacketStatus  packetStatus;   // RSSI, signal RSSI and SNR in 1/4 dB
+
+  int8_t    Rssi(void) const { return SX126xQuarterDbToDb(packetStatus.rssi); }   // dBm
+  int8_t    Snr(void) const  { return SX126xQuarterDbToDb(packetStatus.snr); }    // dB
+};
+
+
+// One step of the LinkAdaptBegin() rate ladder
+struct SX126xLinkRate {
+  uint8_t   spreadingFactor;
+  uint8_t   bandwidth;          // SX126X_LORA_BW_*
+  uint8_t   codingRate;         // SX126X_LORA_CR_*
+};
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  One channel of a HopBegin() table with the command parameters of the retune already worked out. A frequency converts
+//  implicitly, so a table declared constexpr is computed at compile time:
+//
+//    constexpr SX126xHopChannel channels[] = { 902300000, 902500000, 902700000, 902900000 };
+//----------------------------------------------------------------------------------------------------------------------------
+struct SX126xHopChannel {
+  uint32_t  frequencyInHz;
+  uint8_t   rfFrequency[4];        // frequency word, MSB first
+  uint8_t   calibrateImage[2];     // image calibration band
+
+  constexpr SX126xHopChannel(uint32_t frequencyInHz)
+    : frequencyInHz(frequencyInHz),
+      rfFrequency{ (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 24), (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 16),
+                   (uint8_t)(SX126xFrequencyWord(frequencyInHz) >> 8),  (uint8_t)SX126xFrequencyWord(frequencyInHz) },
+      calibrateImage{ (uint8_t)(SX126xImageCalibration(frequencyInHz) >> 8), (uint8_t)SX126xImageCalibration(frequencyInHz) }
+  {
+  }
+};
+
+
+// Frame in the send window of ReliableSend(), the payload is owned by the caller
+struct SX126xArqFrame {
+  uint8_t*  data;
+  uint8_t   len;
+  uint8_t   retries;
+  bool      pending;            // waits for its first or next transmission
+  bool      done;               // acknowledged or given up, the window slides over it
+};
+
+
+// Frame waiting in the driver's TX queue, the payload is owned by the caller
+struct SX126xTxFrame {
+  uint8_t*  data;
+  uint16_t  len;
+  uint32_t  timeoutInMs;
+  uint8_t   id;
+  uint8_t   headerLen;          // 0, or SX126X_STREAM_HEADER_SIZE for a stream fragment
+  uint8_t   header[SX126X_STREAM_HEADER_SIZE];   // sent in front of data
+};
+
+
+// Snapshot of the driver's counters returned by GetStats(). The counters only grow (and wrap), so report the difference
+// between two snapshots. With SX126X_STATS 0 only the command and BUSY counters, which the driver needs anyway, are kept.
+struct SX126xStats {
+  uint32_t  spiCommands;        // commands sent to the chip
+  uint32_t  spiSuppressed;      // commands skipped because the shadow showed they would not change anything
+  uint32_t  spiBytes;           // bytes clocked over SPI, command and status bytes included
+  uint32_t  busyWaitUs;         // time spent waiting for BUSY to fall
+  uint32_t  busyTimeouts;
+  uint32_t  isrCount;           // DIO1 interrupts
+  uint32_t  isrTimeUs;          // total time spent in the DIO1 interrupt
+  uint32_t  isrMaxUs;           // longest DIO1 interrupt
+  uint32_t  txDone;
+  uint32_t  txTimeouts;
+  uint32_t  rxDone;             // packets received, CRC errors included
+  uint32_t  rxTimeouts;
+  uint32_t  rxDropped;          // packets lost because the RX ring was full
+  uint32_t  crcErrors;
+  uint32_t  headerErrors;       // LoRa header errors seen with the next DIO1 event
+};
 
 
 // Interface class
 class SX126x {
 
-  static void DIO1_ISR_1(void);
-  static void DIO1_ISR_2(void);
+  typedef void (*Dio1Isr_t)(void);
+
+  static SX126x* Instances[SX126X_MAX_INSTANCES];
+
+  template<uint8_t N> static void Dio1Isr(void)
+  {
+    SX126x* radio = Instances[N];
+    if ( radio != nullptr ) {
+      radio->Dio1Interrupt();
+    }
+  }
 
-  static SX126x* module1_ptr;
-  static SX126x* module2_ptr;
+  // trampoline of slot i, instantiates Dio1Isr<0> .. Dio1Isr<N-1>
+  template<uint8_t N> static Dio1Isr_t Dio1IsrAt(uint8_t i)
+  {
+    return (i == N - 1) ? &Dio1Isr<N - 1> : Dio1IsrAt<N - 1>(i);
+  }
 
   public:
+#ifdef ARDUINO
     SX126x(int spiSelect, int reset, int busy, int interrupt);   
+#endif
+    SX126x(SX126xHal* hal);
+    ~SX126x();
 
     uint8_t   ModuleConfig(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode = SX126X_DEFAULT_MODE_RX_CONTINUOUS);
-    uint8_t   LoRaBegin(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t payloadLen, bool crcOn, bool invertIrq);
+    uint8_t   LoRaBegin(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq);
+    uint8_t   LoRaBegin(const SX126xLoRaProfile& profile);
+    uint8_t   ModuleConfigAsync(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode = SX126X_DEFAULT_MODE_RX_CONTINUOUS);
+    uint8_t   LoRaBeginAsync(uint8_t spreadingFactor, uint8_t bandwidth, uint8_t codingRate, uint16_t preambleLength, uint8_t headerMode, bool crcOn, bool invertIrq);
+    uint8_t   LoRaBeginAsync(const SX126xLoRaProfile& profile);
+    bool      ConfigPending(void);
+    void      setConfigDoneHook(void (*configHook)(SX126x* radio, uint8_t status));
+    uint8_t   GfskBegin(uint32_t bitRate, uint32_t frequencyDeviation, uint8_t rxBandwidth, uint8_t pulseShape, uint16_t preambleLength,
+                        const uint8_t *syncWord, uint8_t syncWordLength, uint8_t crcType = SX126X_GFSK_CRC_2_BYTE_INV, bool whitening = true,
+                        uint8_t addressFilter = SX126X_GFSK_ADDRESS_FILT_OFF, uint8_t nodeAddress = 0, uint8_t broadcastAddress = 0);
+    uint8_t   WarmStart(const SX126xRetainedConfig* retained);
+    uint8_t   Sleep(SX126xRetainedConfig* retained, uint8_t sleepConfig = SX126X_SLEEP_START_WARM);
+    uint32_t  GetSleepTime(void);
     uint8_t   Receive(uint8_t *pData, uint16_t *len);
     uint8_t   Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs = 0);
     uint8_t   SendAsync(uint8_t *pData, uint16_t len, uint32_t timeoutInMs = 0);
+    uint8_t   SendQueued(uint8_t *pData, uint16_t len, uint32_t timeoutInMs = 0, uint8_t *queueId = NULL);
+    uint8_t   GetTxBacklog(void);
+    void      SetProtocolFraming(bool enable);
     uint8_t   GetCurrentMode(void);
     uint8_t   ReceiveMode(uint32_t timeoutInMs);
+    uint8_t   ReceiveDutyCycle(uint16_t preambleLength = 0);
+    uint8_t   ReceiveCad(uint32_t intervalInMs = 0);
+    uint8_t   SetCadThresholds(uint8_t symbolNum, uint8_t detPeak = 0, uint8_t detMin = SX126X_CAD_DET_MIN);
+    void      SetListenBeforeTalk(uint8_t maxAttempts, uint32_t backoffSlotInUs = 0);
     void      ReceiveStatus(int8_t *rssiPacket, int8_t *snrPacket);
+    void      GetPacketStatus(SX126xPacketStatus *status);
+    void      GetChipStats(uint16_t *received, uint16_t *crcErrors, uint16_t *headerErrors);
+    void      ResetChipStats(void);
+    uint32_t  GetTimeOnAir(uint16_t payloadLen);
+    uint8_t   SetDutyCycleBand(uint8_t index, uint32_t minHz, uint32_t maxHz, uint16_t divisor, uint32_t maxBurstInMs);
+    uint32_t  GetTxDelay(uint16_t len);
+    void      GetCommandCounts(uint32_t *issued, uint32_t *suppressed);
+    void      GetBusyStats(uint32_t *waitUs, uint32_t *timeouts);
+    void      GetStats(SX126xStats *stats);
+    void      SetBusyTimeout(uint32_t timeoutInUs);
+    void      setBusyWaitHook(void (*busyHook)(SX126x* radio));
     void      SetTxPower(int8_t txPowerInDbm);
     void      Dio1Interrupt(void);
+    void      Service(void);
+    void      SetServiceMode(uint8_t mode);
+    void      setServiceHook(void (*serviceHook)(SX126x* radio));
+    uint32_t  GetEventTimestamp(void);
     uint16_t  GetDeviceErrors(void);
+    float     GetSpiThroughput(void);
     void      ClearDeviceErrors(void);
     void      setTxDoneHook(void (*txHook)(uint8_t txStatus));
+    void      setTxDoneHook(void (*txHook)(uint8_t txStatus, uint8_t queueId));
     void      setRxDoneHook(void (*rxHook)(uint8_t rxStatus, uint8_t *pdata, uint16_t len));
+    void      setRxDoneHook(void (*rxHook)(uint8_t rxStatus, SX126xRxPacket *packet));
+    SX126xRxPacket* BorrowRxPacket(void);
+    void      ReleaseRxPacket(void);
+    uint8_t   StreamSend(uint8_t *data, uint32_t len, uint32_t timeoutInMs = 0);
+    uint8_t   StreamReceive(uint8_t *buffer, uint32_t maxLen);
+    void      setStreamSource(uint8_t* (*source)(uint32_t offset, uint16_t len));
+    void      setStreamTxHook(void (*streamHook)(uint8_t status, uint32_t sent, uint32_t total));
+    void      setStreamRxHook(void (*streamHook)(uint8_t status, uint32_t received, uint32_t total));
+    uint8_t   ReliableSend(uint8_t *pData, uint8_t len, uint8_t *seq = NULL);
+    uint8_t   ReliablePending(void);
+    void      ReliableReceive(bool enable);
+    void      setReliableTxHook(void (*reliableHook)(uint8_t status, uint8_t seq));
+    uint8_t   LinkAdaptBegin(const SX126xLinkRate *rates, uint8_t count, uint8_t rate, int8_t minPowerInDbm, int8_t maxPowerInDbm, int8_t targetMarginInDb);
+    void      LinkAdaptEnd(void);
+    uint8_t   LinkAdapt(void);
+    uint8_t   LinkReport(void);
+    int8_t    GetLinkMargin(void);
+    void      SetPeerMargin(int8_t marginInDb, uint8_t headroomInDb = 0);
+    uint8_t   GetLinkRate(void);
+    int8_t    GetLinkTxPower(void);
+    void      setLinkHook(void (*linkHook)(uint8_t status, uint8_t rate, int8_t txPowerInDbm));
+    uint8_t   HopBegin(const SX126xHopChannel *channels, uint8_t count, uint8_t channel, uint8_t hopMode);
+    void      HopEnd(void);
+    uint8_t   HopTo(uint8_t channel);
+    uint8_t   GetHopChannel(void);
+    void      setHopHook(uint8_t (*hopHook)(uint8_t channel));
 
 
   private:
     void      (*__txDoneHook)(uint8_t txStatus);
+    void      (*__txQueueDoneHook)(uint8_t txStatus, uint8_t queueId);
     void      (*__rxDoneHook)(uint8_t rxStatus, uint8_t *pdata, uint16_t len);
-    static    SPISettings SX126X_SPI_SETTINGS;
+    void      (*__rxPacketHook)(uint8_t rxStatus, SX126xRxPacket *packet);
+    void      (*__serviceHook)(SX126x* radio);
+    void      (*__busyHook)(SX126x* radio);
+    void      (*__configHook)(SX126x* radio, uint8_t status);
+    uint8_t*  (*__streamSource)(uint32_t offset, uint16_t len);
+    void      (*__streamTxHook)(uint8_t status, uint32_t sent, uint32_t total);
+    void      (*__streamRxHook)(uint8_t status, uint32_t received, uint32_t total);
+    void      (*__reliableTxHook)(uint8_t status, uint8_t seq);
+    void      (*__linkHook)(uint8_t status, uint8_t rate, int8_t txPowerInDbm);
+    uint8_t   (*__hopHook)(uint8_t channel);
     volatile  bool        txActive;
+    volatile  bool        EventPending;
+    volatile  uint32_t    EventTimestamp;
+    uint8_t               ServiceMode;
+    uint8_t               TxStatus;
 
-    uint8_t   PacketParams[6];
+    uint8_t   PacketParams[SX126X_GFSK_PACKET_PARAMS];     // LoRa uses the first SX126X_LORA_PACKET_PARAMS
     uint8_t   DefaultMode;
-    float     SymbolRate;
+    uint8_t   PacketType;
+    uint8_t   ModulationParams[8];                         // LoRa uses the first 4
+    uint8_t   GfskRegisters[SX126X_GFSK_SYNC_WORD_MAX + 2];  // sync word, node and broadcast address
+    uint32_t  SpiBlockBytes;
+    uint32_t  SpiBlockMicros;
+
+    SX126xRxPacket        RxRing[SX126X_RX_RING_SLOTS];
+    SX126xRxPacket        RxHookPacket;       // packet handed to the RX hooks, the ring is left to BorrowRxPacket()
+    volatile  uint8_t     RxHead;
+    volatile  uint8_t     RxTail;
+
+    SX126xTxFrame         TxQueue[SX126X_TX_QUEUE_DEPTH];
+    volatile  uint8_t     TxQueueHead;
+    volatile  uint8_t     TxQueueTail;
+    uint8_t               TxId;
+    uint8_t               NextTxId;
+    uint8_t               TxFragmentLen;      // payload of the stream fragment on air, 0 for other frames
+    bool                  ProtocolFraming;    // application frames with a reserved first byte are escaped
+    uint8_t               InstanceSlot;
+
+    SX126xDutyCycleBand   DutyCycleBands[SX126X_DUTY_CYCLE_BANDS];
+    uint32_t              RfFrequency;
+    uint8_t               TxBand;
+    uint32_t              TxReservedUs;
+    uint32_t              TxStartMicros;
+
+    uint8_t               ShadowParams[SX126X_SHADOW_SLOTS][SX126X_SHADOW_MAX_PARAMS + 1];   // [0] = length, 0xFF = unknown
+    uint8_t               ChipMode;
+    volatile  uint16_t    IrqMaybeSet;
+    uint32_t              CmdIssued;
+    uint32_t              CmdSuppressed;
+    bool                  ShadowStale;
+    uint32_t              SleepStartMs;
+    uint32_t              SleepStartMicros;   // micros() of SetSleep, see SX126X_SLEEP_SETTLE_US
+    uint32_t              SleepTotalMs;
+    uint16_t              SniffPreamble;
 
-    int       SX126x_SPI_SELECT;
-    int       SX126x_RESET;
-    int       SX126x_BUSY;
-    int       SX126x_INT0;
+    uint8_t               CadSymbolNum;
+    uint8_t               CadDetPeak;         // 0 = SX126xCadDetPeak() of the current spreading factor
+    uint8_t               CadDetMin;
+    uint32_t              CadRxIntervalMs;
+    uint32_t              CadRxDueMs;
+    bool                  CadRxPending;
+    uint8_t               LbtMaxAttempts;     // 0 = listen before talk off
+    uint32_t              LbtSlotUs;
+    uint8_t               LbtAttempt;
+    bool                  LbtCadActive;
+    volatile  bool        LbtBackoff;
+    uint32_t              LbtRetryMicros;
+    uint32_t              TxTimeoutMs;
+    uint32_t              RandomState;
 
-    void      SPIwriteCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy = true);
-    void      SPIreadCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy = true);
-    void      SPItransfer(uint8_t cmd, bool write, uint8_t* dataOut, uint8_t* dataIn, uint8_t numBytes, bool waitForBusy);
+    uint32_t              BusyTimeoutUs;
+    uint32_t              BusyWaitUs;
+    uint32_t              BusyTimeouts;
+    SX126xStats           Stats;              // counters kept outside: spiCommands, spiSuppressed, busyWaitUs, busyTimeouts
+
+    uint8_t*              StreamTxData;       // NULL when fragments come from __streamSource
+    uint32_t              StreamTxLen;
+    uint32_t              StreamTxSent;
+    uint32_t              StreamTxTimeoutMs;
+    uint16_t              StreamTxCount;
+    uint16_t              StreamTxNext;       // next fragment to queue
+    uint8_t               StreamTxId;
+    volatile  bool        StreamTxActive;
+    uint8_t*              StreamRxBuffer;     // NULL = stream reception off
+    uint32_t              StreamRxMax;
+    uint32_t              StreamRxBytes;
+    uint32_t              StreamRxTotal;
+    uint16_t              StreamRxCount;
+    uint16_t              StreamRxNext;
+    uint16_t              StreamRxReceived;
+    uint8_t               StreamRxId;
+    uint8_t               StreamRxFragmentSize;   // of the sender, taken from the header
+    bool                  StreamRxInTransfer;
+
+    SX126xArqFrame        ArqTx[SX126X_ARQ_WINDOW];   // indexed by sequence number % SX126X_ARQ_WINDOW
+    volatile  uint8_t     ArqTxBase;          // oldest frame not yet done, written by the ISR
+    volatile  uint8_t     ArqTxNextSeq;       // sequence number of the next ReliableSend(), written by the application
+    uint8_t               ArqTxSession;       // random per sender, lets the receiver notice a restart
+    uint8_t               ArqTxSeq;           // frame on air
+    bool                  ArqTxOnAir;         // the frame on air is a ReliableSend() frame
+    bool                  ArqTxAckOnAir;      // the frame on air is an acknowledgement
+    bool                  ArqTxAckRequested;  // the frame on air asks for an acknowledgement
+    volatile  bool        ArqAckWait;
+    uint32_t              ArqAckDeadline;     // micros()
+    bool                  ArqRxEnabled;
+    uint8_t               ArqRxSession;
+    uint8_t               ArqRxBase;          // next expected sequence number
+    uint16_t              ArqRxBitmap;        // bit n: ArqRxBase + 1 + n received
+    bool                  ArqAckDue;          // answer the frame being received once it has been read
+
+    const SX126xLinkRate* LinkRates;          // NULL = link adaptation off
+    uint8_t               LinkRateCount;
+    uint8_t               LinkRate;           // index of the rate in use
+    uint8_t               LinkNextRate;       // rate being switched to
+    uint8_t               LinkPrevRate;       // rate to go back to if the switch is not confirmed
+    int8_t                LinkMinPower;
+    int8_t                LinkMaxPower;
+    int8_t                LinkPower;
+    int8_t                LinkNextPower;
+    int16_t               LinkTargetQdb;      // target margin, dB * 4
+    int16_t               LinkLocalQdb;       // margin of the frames we receive, dB * 4
+    int16_t               LinkPeerQdb;        // margin of our frames at the peer, dB * 4
+    int16_t               LinkPeerHeadQdb;    // TX power the peer has left, dB * 4
+    bool                  LinkLocalValid;
+    bool                  LinkPeerValid;
+    uint8_t               LinkState;          // SX126X_LINK_STATE_*
+    uint8_t               LinkAttempts;
+    bool                  LinkTimerArmed;
+    uint32_t              LinkDeadline;       // micros()
+    uint32_t              LinkHeardMs;        // millis() of the last frame received
+    bool                  LinkTxOnAir;        // the frame on air is a link frame
+    uint8_t               LinkTxType;         // type of the link frame on air
+    uint8_t               LinkTxPending;      // link frame to send once the radio is free, SX126X_LINK_NONE = none
+
+    const SX126xHopChannel* HopChannels;      // NULL = no hop table
+    uint8_t               HopCount;
+    uint8_t               HopChannel;         // index of the channel in use
+    uint8_t               HopMode;            // SX126X_HOP_* flags
+
+    uint8_t               SeqStep;            // next SX126X_SEQ_* step, SX126X_SEQ_IDLE = no sequence
+    uint8_t               SeqStatus;
+    bool                  SeqBlocking;
+    bool                  SeqIssuing;         // commands sent by a step skip their BUSY wait
+    bool                  SeqLoRaQueued;
+    uint32_t              SeqStepMicros;
+    uint32_t              SeqHoldUs;
+    uint32_t              SeqBusyTimeouts;
+    uint32_t              SeqFrequencyInHz;
+    int8_t                SeqTxPower;
+    uint32_t              SeqLoRaFrequencyInHz;
+    uint8_t               SeqRfFrequency[4];
+    uint8_t               SeqModulationParams[4];
+    uint8_t               SeqPacketParams[SX126X_LORA_PACKET_PARAMS];
+
+#ifdef ARDUINO
+    SX126xArduinoHal      ArduinoHal;
+#endif
+    SX126xHal*            Hal;
+
+    uint8_t   SPIwriteCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy = true);
+    uint8_t   SPIreadCommand(uint8_t cmd, uint8_t* data, uint8_t numBytes, bool waitForBusy = true);
+    uint8_t   SPItransfer(uint8_t cmd, bool write, uint8_t* dataOut, uint8_t* dataIn, uint8_t numBytes, bool waitForBusy);
 
     void      SetDio3AsTcxoCtrl(uint8_t tcxoVoltage, uint32_t timeoutInMs);
     void      SetDio2AsRfSwitchCtrl(uint8_t enable);
-    void      Reset(void);
     void      SetStandby(uint8_t mode);
-    void      WaitOnBusy(void);
+    uint8_t   WaitOnBusy(void);
     void      SetRfFrequency(uint32_t frequency);
     void      Calibrate(uint8_t calibParam);
     void      CalibrateImage(uint32_t frequency);
@@ -417,11 +1011,76 @@ class SX126x {
     void      SetRx(uint32_t timeoutInMs);
     void      SetTx(uint32_t timeoutInMs);
     void      SetFs(void);
+    uint8_t   SetRxDutyCycle(uint16_t preambleLength);
+    void      SetCad(uint8_t exitMode, uint32_t timeout);
+    uint32_t  SymbolTime(void);
+    uint32_t  CadRxTimeout(void);
     void      GetRxBufferStatus(uint8_t *payloadLength, uint8_t *rxStartBufferPointer);
-    void      Wakeup(void);
+    uint8_t   Wakeup(void);
+    void      SetSleep(uint8_t sleepConfig);
     uint8_t   GetStatus(void);
+    uint8_t   GetPacketType(void);
     uint8_t   ReadBuffer(uint8_t *rxData, uint16_t *rxDataLen);
-    uint8_t   WriteBuffer(uint8_t *txData, uint16_t txDataLen);
+    uint8_t   ReadBufferAt(uint8_t offset, uint8_t *rxData, uint16_t len);
+    uint8_t   WriteBuffer(uint8_t *txData, uint16_t txDataLen, const uint8_t *header = NULL, uint8_t headerLen = 0);
+    uint8_t   RxRingCount(void);
+    void      InitMembers(void);
+    bool      AttachInstance(void);
+    void      DetachInstance(void);
+    void      ServiceIrq(void);
+    uint8_t   StartModuleConfig(uint8_t packetType, uint32_t frequencyInHz, int8_t txPowerInDbm, uint8_t defaultMode);
+    void      SetLoRaProfile(const SX126xLoRaProfile& profile);
+    void      StartSequence(uint8_t step);
+    uint8_t   RunSequence(bool blocking);
+    void      RunSequenceStep(void);
+    void      FinishSequence(uint8_t status);
+    uint8_t   TxQueueCount(void);
+    void      StartQueuedTx(void);
+    uint8_t   QueueFrame(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, const uint8_t *header, uint8_t headerLen);
+    uint8_t   StartTx(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, const uint8_t *header = NULL, uint8_t headerLen = 0);
+    void      StreamFill(void);
+    void      StreamFragmentSent(uint8_t len);
+    bool      ReceiveFragment(const uint8_t *header, uint8_t len, uint8_t offset);
+    void      EndStreamRx(uint8_t status);
+    bool      ArqStartNext(void);
+    void      ArqFrameSent(void);
+    void      ArqRetransmit(bool all);
+    void      ArqSlide(void);
+    bool      ReceiveReliable(const uint8_t *header, uint8_t *len, uint8_t *offset);
+    void      ArqAdvanceRx(void);
+    void      SendAck(void);
+    int16_t   LinkRateDelta(uint8_t from, uint8_t to);
+    void      ApplyLinkRate(uint8_t rate);
+    void      LinkMeasure(const SX126xPacketStatus *status);
+    void      LinkSend(uint8_t type);
+    void      LinkFrameSent(void);
+    bool      ReceiveLink(const uint8_t *frame, uint8_t len);
+    void      LinkTimeout(void);
+    void      EndLinkSwitch(uint8_t status);
+    void      Retune(uint8_t channel);
+    void      NextHop(void);
+    void      FinishTx(void);
+    void      BackOff(void);
+    uint32_t  Random(void);
+    uint32_t  AutoTimeout(uint16_t payloadLen);
+    uint8_t   GetPayloadLength(void);
+    void      SetPayloadLength(uint8_t len);
+    void      WriteGfskRegisters(void);
+    void      WriteRegister(uint16_t address, uint8_t *data, uint8_t len);
+    uint8_t   FindDutyCycleBand(void);
+    void      RefillDutyCycleBand(SX126xDutyCycleBand* band);
+    bool      DutyCycleAllows(uint16_t len);
+    void      SettleDutyCycle(uint32_t doneMicros);
+    void      InvalidateShadow(void);
+    uint8_t   WakeIfAsleep(void);
+    void      RestoreShadow(void);
+    void      InvalidateShadowSlot(uint8_t cmd);
+    bool      ShadowMatches(uint8_t cmd, uint8_t* data, uint8_t numBytes);
 };
 
+template<> inline SX126x::Dio1Isr_t SX126x::Dio1IsrAt<0>(uint8_t)
+{
+  return nullptr;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "SX126xDual.h"
+
+
+SX126xDual::SX126xDual(SX126x* radio0, SX126x* radio1, uint8_t mode)
+{
+  Radios[0]  = radio0;
+  Radios[1]  = radio1;
+  Mode       = mode;
+  TxLast     = 1;
+  RxNext     = 0;
+  RxBorrowed = SX126X_DUAL_NONE;
+}
+
+
+void SX126xDual::SetMode(uint8_t mode)
+{
+  Mode = mode;
+}
+
+
+SX126x* SX126xDual::GetRadio(uint8_t index)
+{
+  return (index < 2) ? Radios[index] : NULL;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Queues a frame on one of the two radios, see SX126x::SendQueued(). With SX126X_DUAL_SHARED a frame that does not fit
+//  in the queue of the radio picked first is queued on the other one.
+//
+//  Parameters:
+//  pData, len:   frame to send, not copied
+//  timeoutInMs:  TX timeout, see SX126x::SendQueued()
+//  radio:        optional, receives the index of the radio the frame was queued on
+//  queueId:      optional, receives the ID that radio reports the frame's completion with
+//
+//  Return value:
+//  ERR_NONE, ERR_PACKET_TOO_LONG or ERR_DEVICE_BUSY when no radio had room for the frame
+//----------------------------------------------------------------------------------------------------------------------------
+uint8_t SX126xDual::Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs, uint8_t *radio, uint8_t *queueId)
+{
+  uint8_t index = PickTxRadio();
+  uint8_t rv = Radios[index]->SendQueued(pData, len, timeoutInMs, queueId);
+
+  if ( rv == ERR_DEVICE_BUSY && Mode == SX126X_DUAL_SHARED )
+  {
+    index ^= 1;
+    rv = Radios[index]->SendQueued(pData, len, timeoutInMs, queueId);
+  }
+
+  if ( rv == ERR_NONE )
+  {
+    TxLast = index;
+    if ( radio != NULL ) {
+      *radio = index;
+    }
+  }
+  return rv;
+}
+
+
+// the radio with the shorter backlog, on a tie the one that did not send last so both get their share of RX time
+uint8_t SX126xDual::PickTxRadio(void)
+{
+  if ( Mode == SX126X_DUAL_DEDICATED ) {
+    return 1;
+  }
+
+  uint8_t backlog0 = Radios[0]->GetTxBacklog();
+  uint8_t backlog1 = Radios[1]->GetTxBacklog();
+  if ( backlog0 != backlog1 ) {
+    return (backlog0 < backlog1) ? 0 : 1;
+  }
+  return TxLast ^ 1;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Returns a received packet of either radio without copying it, see SX126x::BorrowRxPacket(). The two RX rings are
+//  looked at in turn, so a busy channel can not starve the other one. Only one packet can be borrowed at a time.
+//
+//  Parameters:
+//  radio:        optional, receives the index of the radio the packet was received on
+//
+//  Return value:
+//  oldest packet of the next ring that holds one, NULL if both are empty or a packet is already borrowed
+//----------------------------------------------------------------------------------------------------------------------------
+SX126xRxPacket* SX126xDual::BorrowRxPacket(uint8_t *radio)
+{
+  if ( RxBorrowed != SX126X_DUAL_NONE ) {
+    return NULL;
+  }
+
+  for ( uint8_t i = 0; i < 2; i++ )
+  {
+    uint8_t index = (RxNext + i) & 1;
+    SX126xRxPacket* packet = Radios[index]->BorrowRxPacket();
+    if ( packet != NULL )
+    {
+      RxBorrowed = index;
+      if ( radio != NULL ) {
+        *radio = index;
+      }
+      return packet;
+    }
+  }
+  return NULL;
+}
+
+
+void SX126xDual::ReleaseRxPacket(void)
+{
+  if ( RxBorrowed != SX126X_DUAL_NONE )
+  {
+    Radios[RxBorrowed]->ReleaseRxPacket();
+    RxNext = RxBorrowed ^ 1;
+    RxBorrowed = SX126X_DUAL_NONE;
+  }
+}
+
+
+// call from loop(), runs the deferred work of both radios
+void SX126xDual::Service(void)
+{
+  Radios[0]->Service();
+  Radios[1]->Service();
+}
@@ -0,0 +1,50 @@
+#ifndef _SX126X_DUAL_H
+#define _SX126X_DUAL_H
+
+#include "SX126x.h"
+
+#define SX126X_DUAL_DEDICATED                         0x00        // radio 0 only receives, radio 1 sends every frame
+#define SX126X_DUAL_SHARED                            0x01        // both receive, each frame goes out on the radio that is free
+#define SX126X_DUAL_NONE                              0xFF        // no radio, e.g. no packet borrowed
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Runs two SX126x modules on one host as a single link with concurrent TX and RX. Each radio keeps its own TX queue,
+//  RX ring and txActive, so a frame on air on one radio never stops the other one from receiving.
+//
+//  SX126X_DUAL_DEDICATED leaves radio 0 receiving all the time and queues every frame on radio 1. SX126X_DUAL_SHARED
+//  splits channels instead: each radio receives on its own frequency in its default mode, and a frame is queued on the
+//  radio with the shorter TX backlog, alternating between the two when both are free. If that radio's queue is full, the
+//  frame goes to the other one. Received packets of both radios come out of one queue, taken from the two RX rings in
+//  turn.
+//
+//  The coordinator does not configure the radios: set each one up with ModuleConfig()/LoRaBegin() first, e.g. with the
+//  TX and RX channels apart, and without RX hooks, so packets are kept in their rings. TX done hooks, stats and every other
+//  setting stay per radio. The two antennas need enough isolation for one radio to receive while the other sends.
+//
+//    SX126xDual relay(&radio0, &radio1, SX126X_DUAL_DEDICATED);
+//    relay.Send(data, len);
+//    SX126xRxPacket* packet = relay.BorrowRxPacket();
+//----------------------------------------------------------------------------------------------------------------------------
+class SX126xDual {
+
+  public:
+    SX126xDual(SX126x* radio0, SX126x* radio1, uint8_t mode = SX126X_DUAL_DEDICATED);
+
+    void      SetMode(uint8_t mode);
+    SX126x*   GetRadio(uint8_t index);
+    uint8_t   Send(uint8_t *pData, uint16_t len, uint32_t timeoutInMs = 0, uint8_t *radio = NULL, uint8_t *queueId = NULL);
+    SX126xRxPacket* BorrowRxPacket(uint8_t *radio = NULL);
+    void      ReleaseRxPacket(void);
+    void      Service(void);
+
+  private:
+    SX126x*   Radios[2];
+    uint8_t   Mode;
+    uint8_t   TxLast;             // radio the last frame was queued on
+    uint8_t   RxNext;             // ring looked at first by the next BorrowRxPacket()
+    uint8_t   RxBorrowed;         // radio of the borrowed packet, SX126X_DUAL_NONE = none
+
+    uint8_t   PickTxRadio(void);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "SX126xHal.h"
+
+#ifdef ARDUINO
+
+SPISettings SX126xArduinoHal::SX126X_SPI_SETTINGS(8000000, MSBFIRST, SPI_MODE0);
+
+SX126xArduinoHal::SX126xArduinoHal(int spiSelect, int reset, int busy, int interrupt)
+{
+  SX126x_SPI_SELECT = spiSelect;
+  SX126x_RESET      = reset;
+  SX126x_BUSY       = busy;
+  SX126x_INT0       = interrupt;
+}
+
+
+void SX126xArduinoHal::Begin(void)
+{
+  pinMode(SX126x_SPI_SELECT, OUTPUT);
+  pinMode(SX126x_RESET, OUTPUT);
+  pinMode(SX126x_BUSY, INPUT);
+  pinMode(SX126x_INT0, INPUT);
+
+  digitalWrite(SX126x_SPI_SELECT, HIGH);
+  digitalWrite(SX126x_RESET, HIGH);
+
+  SPI.begin();
+}
+
+
+void SX126xArduinoHal::SpiBegin(void)
+{
+  digitalWrite(SX126x_SPI_SELECT, LOW);
+  SPI.beginTransaction(SX126X_SPI_SETTINGS);
+}
+
+
+void SX126xArduinoHal::SpiEnd(void)
+{
+  SPI.endTransaction();
+  digitalWrite(SX126x_SPI_SELECT, HIGH);
+}
+
+
+uint8_t SX126xArduinoHal::SpiTransfer(uint8_t data)
+{
+  return SPI.transfer(data);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Every Arduino core implements the in place SPI.transfer(buf, len); on most 32 bit cores it is backed by a FIFO or DMA
+//  engine and runs at the full SPI clock instead of paying the per byte call overhead. ESP32 can also clock out a const
+//  buffer directly. Other cores need a writable buffer, so outgoing blocks are staged through a small stack buffer.
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126xArduinoHal::SpiTransferBlock(const uint8_t* dataOut, uint8_t* dataIn, uint16_t len)
+{
+#if defined(SX126X_SPI_BYTE_LOOP)
+  SX126xHal::SpiTransferBlock(dataOut, dataIn, len);
+#else
+  if ( dataIn != NULL )
+  {
+    if ( dataOut != NULL ) {
+      memcpy(dataIn, dataOut, len);
+    }
+    else {
+      memset(dataIn, 0x00, len);
+    }
+    SPI.transfer(dataIn, len);
+  }
+  else if ( dataOut != NULL )
+  {
+#if defined(ARDUINO_ARCH_ESP32)
+    SPI.writeBytes(dataOut, len);
+#else
+    uint8_t chunk[32];
+    while ( len > 0 )
+    {
+      uint16_t n = (len > sizeof(chunk)) ? sizeof(chunk) : len;
+      memcpy(chunk, dataOut, n);
+      SPI.transfer(chunk, n);
+      dataOut += n;
+      len -= n;
+    }
+#endif
+  }
+  else
+  {
+    while ( len-- > 0 ) {
+      SPI.transfer(0x00);
+    }
+  }
+#endif
+}
+
+
+bool SX126xArduinoHal::ReadBusy(void)
+{
+  return digitalRead(SX126x_BUSY);
+}
+
+
+void SX126xArduinoHal::WriteReset(bool level)
+{
+  digitalWrite(SX126x_RESET, level ? HIGH : LOW);
+}
+
+
+void SX126xArduinoHal::DelayMicroseconds(uint32_t us)
+{
+  delayMicroseconds(us);
+}
+
+
+void SX126xArduinoHal::Yield(void)
+{
+  yield();
+}
+
+
+uint32_t SX126xArduinoHal::Micros(void)
+{
+  return micros();
+}
+
+
+uint32_t SX126xArduinoHal::Millis(void)
+{
+  return millis();
+}
+
+
+void SX126xArduinoHal::AttachDio1(void (*isr)(void))
+{
+  attachInterrupt(digitalPinToInterrupt(SX126x_INT0), isr, RISING);
+}
+
+
+void SX126xArduinoHal::DetachDio1(void)
+{
+  detachInterrupt(digitalPinToInterrupt(SX126x_INT0));
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef _SX126X_HAL_H
+#define _SX126X_HAL_H
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Bus and pin backend used by the SX126x driver. Every SPI byte, BUSY poll, reset pulse and DIO1 binding goes through
+//  this interface so the driver can run on top of Arduino SPI/GPIO or on top of a host side model of the chip
+//  (see extras/host/SX126xSim.h).
+//
+//  A SPI transaction is framed by SpiBegin()/SpiEnd(): SpiBegin() pulls NSS low and claims the bus, SpiEnd() releases
+//  the bus and pulls NSS high again. SpiTransferBlock() moves a whole parameter block or payload in one call; the default
+//  implementation falls back to one SpiTransfer() per byte, backends override it with the platform's buffer transfer or
+//  DMA. Either pointer may be NULL: without dataOut NOPs are clocked out, without dataIn the received bytes are dropped.
+//  Yield() is called from loops that wait on the radio so that cooperative schedulers
+//  (and the host model's virtual clock) can make progress.
+//----------------------------------------------------------------------------------------------------------------------------
+class SX126xHal {
+
+  public:
+    virtual ~SX126xHal() {}
+    virtual void      Begin(void) = 0;
+    virtual void      SpiBegin(void) = 0;
+    virtual void      SpiEnd(void) = 0;
+    virtual uint8_t   SpiTransfer(uint8_t data) = 0;
+    virtual void      SpiTransferBlock(const uint8_t* dataOut, uint8_t* dataIn, uint16_t len)
+    {
+      for ( uint16_t i = 0; i < len; i++ )
+      {
+        uint8_t in = SpiTransfer(dataOut ? dataOut[i] : 0x00);
+        if ( dataIn ) {
+          dataIn[i] = in;
+        }
+      }
+    }
+    virtual bool      ReadBusy(void) = 0;
+    virtual void      WriteReset(bool level) = 0;
+    virtual void      DelayMicroseconds(uint32_t us) = 0;
+    virtual void      Yield(void) = 0;
+    virtual uint32_t  Micros(void) = 0;
+    virtual uint32_t  Millis(void) = 0;
+    virtual void      AttachDio1(void (*isr)(void)) = 0;
+    virtual void      DetachDio1(void) = 0;
+};
+
+
+#ifdef ARDUINO
+
+#include "Arduino.h"
+#include <SPI.h>
+
+// Default backend: Arduino SPI library plus digitalRead/digitalWrite on the given pins.
+// Define SX126X_SPI_BYTE_LOOP to move blocks one SPI.transfer(uint8_t) call at a time instead of using the core's
+// buffer transfer.
+class SX126xArduinoHal : public SX126xHal {
+
+  public:
+    SX126xArduinoHal(int spiSelect, int reset, int busy, int interrupt);
+
+    void      Begin(void);
+    void      SpiBegin(void);
+    void      SpiEnd(void);
+    uint8_t   SpiTransfer(uint8_t data);
+    void      SpiTransferBlock(const uint8_t* dataOut, uint8_t* dataIn, uint16_t len);
+    bool      ReadBusy(void);
+    void      WriteReset(bool level);
+    void      DelayMicroseconds(uint32_t us);
+    void      Yield(void);
+    uint32_t  Micros(void);
+    uint32_t  Millis(void);
+    void      AttachDio1(void (*isr)(void));
+    void      DetachDio1(void);
+
+  private:
+    static    SPISettings SX126X_SPI_SETTINGS;
+
+    int       SX126x_SPI_SELECT;
+    int       SX126x_RESET;
+    int       SX126x_BUSY;
+    int       SX126x_INT0;
+};
+
+#endif
+
+#endif
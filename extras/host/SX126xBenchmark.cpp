@@ -0,0 +1,347 @@
+//----------------------------------------------------------------------------------------------------------------------------
+//  Measures what the driver's public operations cost when run against SX126xSim: SPI transactions and bytes, BUSY polls
+//  and stalls, DIO1 interrupt time, virtual time on the model's clock and host time spent in the call. Send, SendAsync
+//  and the receive path are measured for every payload length from 1 to 255 bytes.
+//
+//  Output is CSV on stdout, one row per operation and payload length, every value is the mean over the iterations:
+//
+//    g++ -std=c++11 -O2 -I. -Iextras/host SX126x.cpp SX126xHal.cpp extras/host/SX126xSim.cpp extras/host/SX126xBenchmark.cpp -o sx126x_bench
+//    ./sx126x_bench [iterations] > baseline.csv
+//
+//  The counters and the virtual time only depend on the driver and the model, so two runs of the same source produce
+//  identical columns except host_ns; diff them between releases to catch regressions.
+//
+//  Packets are received two ways. The "ReceiveIsr" rows cover the DIO1 interrupt of one packet (IRQ status, buffer
+//  status, buffer read, packet status) plus BorrowRxPacket() and ReleaseRxPacket(); their virtual time includes the
+//  packet's time on air. The "Receive" rows cover a polling Receive() of a packet that is already in the chip, with the
+//  radio in SX126X_SERVICE_MODE_DEFERRED so the interrupt leaves it there.
+//
+//  "ReceiveIsrReserved" is a "ReceiveIsr" row for an application frame that starts like a ReliableSend() frame, received
+//  with ReliableReceive() and SetProtocolFraming() on. The frame is the one the driver itself sent, with
+//  SX126X_ESCAPE_MARKER in front; it has to come out of BorrowRxPacket() unchanged.
+//
+//  "SendAsyncFromSleep" sends with SX126X_DEFAULT_MODE_SLEEP_WARM, each frame right after the previous one put the chip
+//  to sleep, so its time includes waking the chip and the SX126X_SLEEP_SETTLE_US wait before that.
+//
+//  "ColdStartToTx" and "WarmStartToTx" measure a boot up to the start of the first frame of BENCH_BOOT_PAYLOAD bytes:
+//  a new driver instance runs ModuleConfig(), LoRaBegin() and SendAsync(), or WarmStart() from the record the previous
+//  boot left with Sleep() and SendAsync().
+//----------------------------------------------------------------------------------------------------------------------------
+#include "SX126x.h"
+#include "SX126xSim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#define BENCH_FREQUENCY_HZ      868100000
+#define BENCH_TX_POWER_DBM      14
+#define BENCH_MAX_PAYLOAD       255
+#define BENCH_RX_TIMEOUT_MS     10
+#define BENCH_BOOT_PAYLOAD      16
+#define BENCH_HOST_SLEEP_US     10000
+#define BENCH_RESERVED_PAYLOAD  16
+
+
+static SX126xSim sim;
+static SX126x    lora(&sim);
+
+// last frame the model sent
+static uint8_t   onAir[SX126X_BUFFER_SIZE];
+static uint8_t   onAirLen;
+
+// counters of one operation, summed over the iterations
+struct Sample {
+  uint64_t  spiTransactions;
+  uint64_t  spiBytes;
+  uint64_t  busyPolls;
+  uint64_t  busyStalls;
+  uint64_t  busyStallUs;
+  uint64_t  isrCount;
+  uint64_t  isrUs;
+  uint64_t  virtualUs;
+  uint64_t  hostNs;
+};
+
+// snapshot taken before the measured operation
+struct Probe {
+  SX126xSim::Counters counters;
+  uint64_t  now;
+  std::chrono::steady_clock::time_point host;
+};
+
+
+static void Begin(Probe& probe)
+{
+  probe.counters = sim.counters;
+  probe.now = sim.Now();
+  probe.host = std::chrono::steady_clock::now();
+}
+
+
+static void End(const Probe& probe, Sample& sample)
+{
+  std::chrono::steady_clock::time_point host = std::chrono::steady_clock::now();
+
+  sample.spiTransactions += sim.counters.spiTransactions - probe.counters.spiTransactions;
+  sample.spiBytes        += sim.counters.spiBytes - probe.counters.spiBytes;
+  sample.busyPolls       += sim.counters.busyPolls - probe.counters.busyPolls;
+  sample.busyStalls      += sim.counters.busyStalls - probe.counters.busyStalls;
+  sample.busyStallUs     += sim.counters.busyStallUs - probe.counters.busyStallUs;
+  sample.isrCount        += sim.counters.isrCount - probe.counters.isrCount;
+  sample.isrUs           += sim.counters.isrTimeUs - probe.counters.isrTimeUs;
+  sample.virtualUs       += sim.Now() - probe.now;
+  sample.hostNs          += std::chrono::duration_cast<std::chrono::nanoseconds>(host - probe.host).count();
+}
+
+
+static void Print(const char* op, uint16_t payload, uint32_t iterations, const Sample& sample)
+{
+  double n = iterations;
+  printf("%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.0f\n", op, payload, iterations,
+         sample.spiTransactions / n, sample.spiBytes / n, sample.busyPolls / n, sample.busyStalls / n,
+         sample.busyStallUs / n, sample.isrCount / n, sample.isrUs / n, sample.virtualUs / n, sample.hostNs / n);
+}
+
+
+static uint8_t Configure(SX126x* radio)
+{
+  uint8_t rv = radio->ModuleConfig(SX126X_PACKET_TYPE_LORA, BENCH_FREQUENCY_HZ, BENCH_TX_POWER_DBM, SX126X_DEFAULT_MODE_STBY_RC);
+  if ( rv == ERR_NONE ) {
+    rv = radio->LoRaBegin(7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  }
+  return rv;
+}
+
+
+int main(int argc, char** argv)
+{
+  uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10;
+  if ( iterations == 0 ) {
+    iterations = 1;
+  }
+
+  uint8_t payload[BENCH_MAX_PAYLOAD];
+  for ( uint16_t i = 0; i < BENCH_MAX_PAYLOAD; i++ ) {
+    payload[i] = (uint8_t)i;
+  }
+
+  printf("op,payload,iterations,spi_transactions,spi_bytes,busy_polls,busy_stalls,busy_stall_us,isr_count,isr_us,virtual_us,host_ns\n");
+
+  Probe probe;
+  Sample sample = {};
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    Begin(probe);
+    uint8_t rv = lora.ModuleConfig(SX126X_PACKET_TYPE_LORA, BENCH_FREQUENCY_HZ, BENCH_TX_POWER_DBM, SX126X_DEFAULT_MODE_STBY_RC);
+    End(probe, sample);
+    if ( rv != ERR_NONE ) {
+      fprintf(stderr, "ModuleConfig failed: %u\n", rv);
+      return 1;
+    }
+  }
+  Print("ModuleConfig", 0, iterations, sample);
+
+  // the first LoRaBegin after ModuleConfig sends everything, later ones only what the shadow does not hold
+  sample = Sample();
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    lora.ModuleConfig(SX126X_PACKET_TYPE_LORA, BENCH_FREQUENCY_HZ, BENCH_TX_POWER_DBM, SX126X_DEFAULT_MODE_STBY_RC);
+    Begin(probe);
+    lora.LoRaBegin(7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+    End(probe, sample);
+  }
+  Print("LoRaBegin", 0, iterations, sample);
+
+  sample = Sample();
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    Begin(probe);
+    lora.LoRaBegin(7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+    End(probe, sample);
+  }
+  Print("LoRaBeginUnchanged", 0, iterations, sample);
+
+  if ( Configure(&lora) != ERR_NONE ) {
+    fprintf(stderr, "configuration failed\n");
+    return 1;
+  }
+
+  // Send() blocks until TX_DONE, its virtual time includes the time on air
+  for ( uint16_t len = 1; len <= BENCH_MAX_PAYLOAD; len++ )
+  {
+    sample = Sample();
+    for ( uint32_t i = 0; i < iterations; i++ )
+    {
+      Begin(probe);
+      uint8_t rv = lora.Send(payload, len);
+      End(probe, sample);
+      if ( rv != ERR_NONE ) {
+        fprintf(stderr, "Send(%u) failed: %u\n", len, rv);
+        return 1;
+      }
+    }
+    Print("Send", len, iterations, sample);
+  }
+
+  // SendAsync() up to the return to the caller, the transmission is then run to its end outside the measurement
+  for ( uint16_t len = 1; len <= BENCH_MAX_PAYLOAD; len++ )
+  {
+    sample = Sample();
+    for ( uint32_t i = 0; i < iterations; i++ )
+    {
+      Begin(probe);
+      uint8_t rv = lora.SendAsync(payload, len);
+      End(probe, sample);
+      if ( rv != ERR_NONE ) {
+        fprintf(stderr, "SendAsync(%u) failed: %u\n", len, rv);
+        return 1;
+      }
+      sim.Run(lora.GetTimeOnAir(len) + 10000);
+    }
+    Print("SendAsync", len, iterations, sample);
+  }
+
+  // single RX from STDBY_RC, left to time out outside the measurement
+  sample = Sample();
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    Begin(probe);
+    lora.ReceiveMode(BENCH_RX_TIMEOUT_MS);
+    End(probe, sample);
+    sim.Run(2 * BENCH_RX_TIMEOUT_MS * 1000);
+  }
+  Print("ReceiveMode", 0, iterations, sample);
+
+  lora.ReceiveMode(SX126X_RX_NO_TIMEOUT_CONT);
+  for ( uint16_t len = 1; len <= BENCH_MAX_PAYLOAD; len++ )
+  {
+    sample = Sample();
+    for ( uint32_t i = 0; i < iterations; i++ )
+    {
+      uint32_t toa = sim.TimeOnAir(len);
+      Begin(probe);
+      if ( !sim.InjectPacket(payload, len) )
+      {
+        fprintf(stderr, "packet of %u bytes not received\n", len);
+        return 1;
+      }
+      sim.Run(toa + 1000);
+      SX126xRxPacket* packet = lora.BorrowRxPacket();
+      if ( packet == NULL || packet->len != len )
+      {
+        fprintf(stderr, "packet of %u bytes lost\n", len);
+        return 1;
+      }
+      lora.ReleaseRxPacket();
+      End(probe, sample);
+    }
+    Print("ReceiveIsr", len, iterations, sample);
+  }
+
+  uint8_t reserved[BENCH_RESERVED_PAYLOAD];
+  memcpy(reserved, payload, sizeof(reserved));
+  reserved[0] = SX126X_ARQ_DATA_MARKER;
+  lora.SetProtocolFraming(true);
+  sim.OnTransmit = [](const uint8_t* data, uint8_t len) { memcpy(onAir, data, len); onAirLen = len; };
+  if ( lora.Send(reserved, sizeof(reserved)) != ERR_NONE || onAirLen != sizeof(reserved) + 1 || onAir[0] != SX126X_ESCAPE_MARKER )
+  {
+    fprintf(stderr, "frame with a reserved first byte not escaped\n");
+    return 1;
+  }
+  sim.OnTransmit = nullptr;
+
+  lora.ReliableReceive(true);
+  lora.ReceiveMode(SX126X_RX_NO_TIMEOUT_CONT);
+  sample = Sample();
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    Begin(probe);
+    sim.InjectPacket(onAir, onAirLen);
+    sim.Run(sim.TimeOnAir(onAirLen) + 1000);
+    SX126xRxPacket* packet = lora.BorrowRxPacket();
+    if ( packet == NULL || packet->len != sizeof(reserved) || memcmp(packet->data, reserved, sizeof(reserved)) != 0 )
+    {
+      fprintf(stderr, "frame with a reserved first byte lost\n");
+      return 1;
+    }
+    lora.ReleaseRxPacket();
+    End(probe, sample);
+  }
+  Print("ReceiveIsrReserved", BENCH_RESERVED_PAYLOAD, iterations, sample);
+  lora.ReliableReceive(false);
+  lora.SetProtocolFraming(false);
+
+  lora.SetServiceMode(SX126X_SERVICE_MODE_DEFERRED);
+  for ( uint16_t len = 1; len <= BENCH_MAX_PAYLOAD; len++ )
+  {
+    sample = Sample();
+    for ( uint32_t i = 0; i < iterations; i++ )
+    {
+      sim.InjectPacket(payload, len);
+      sim.Run(sim.TimeOnAir(len) + 1000);
+
+      uint8_t  data[SX126X_BUFFER_SIZE];
+      uint16_t rxLen = sizeof(data);
+      Begin(probe);
+      uint8_t rv = lora.Receive(data, &rxLen);
+      End(probe, sample);
+      if ( rv != ERR_NONE || rxLen != len )
+      {
+        fprintf(stderr, "Receive of %u bytes failed: %u\n", len, rv);
+        return 1;
+      }
+    }
+    Print("Receive", len, iterations, sample);
+  }
+  lora.SetServiceMode(SX126X_SERVICE_MODE_ISR);
+
+  lora.ModuleConfig(SX126X_PACKET_TYPE_LORA, BENCH_FREQUENCY_HZ, BENCH_TX_POWER_DBM, SX126X_DEFAULT_MODE_SLEEP_WARM);
+  lora.LoRaBegin(7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  sample = Sample();
+  for ( uint32_t i = 0; i < iterations; i++ )
+  {
+    Begin(probe);
+    uint8_t rv = lora.SendAsync(payload, BENCH_BOOT_PAYLOAD);
+    End(probe, sample);
+    if ( rv != ERR_NONE )
+    {
+      fprintf(stderr, "SendAsync from sleep failed: %u\n", rv);
+      return 1;
+    }
+    while ( lora.GetTxBacklog() > 0 ) {
+      sim.Run(10);
+    }
+  }
+  Print("SendAsyncFromSleep", BENCH_BOOT_PAYLOAD, iterations, sample);
+
+  // every boot builds its own driver, as after a host reset; the chip model and its retained state carry over
+  SX126xRetainedConfig retained = {};
+  for ( uint8_t warm = 0; warm < 2; warm++ )
+  {
+    sample = Sample();
+    for ( uint32_t i = 0; i < iterations; i++ )
+    {
+      Begin(probe);
+      SX126x* node = new SX126x(&sim);
+      uint8_t rv = warm ? node->WarmStart(&retained) : Configure(node);
+      if ( rv == ERR_NONE ) {
+        rv = node->SendAsync(payload, BENCH_BOOT_PAYLOAD);
+      }
+      End(probe, sample);
+      if ( rv != ERR_NONE )
+      {
+        fprintf(stderr, "%s start failed: %u\n", warm ? "warm" : "cold", rv);
+        return 1;
+      }
+      sim.Run(node->GetTimeOnAir(BENCH_BOOT_PAYLOAD) + 10000);
+      node->Sleep(&retained);
+      delete node;
+      sim.Run(BENCH_HOST_SLEEP_US);
+    }
+    Print(warm ? "WarmStartToTx" : "ColdStartToTx", BENCH_BOOT_PAYLOAD, iterations, sample);
+  }
+
+  return 0;
+}
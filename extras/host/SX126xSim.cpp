@@ -0,0 +1,924 @@
+#include "SX126xSim.h"
+#include "SX126x.h"
+
+#include <string.h>
+#include <math.h>
+
+#define SIM_BUSY_FOREVER          0xFFFFFFFFFFFFFFFFull
+#define SIM_BUSY_DEFAULT_US       5       // register style commands
+#define SIM_BOOT_US               3500    // reset or cold wake until BUSY falls
+#define SIM_WARM_WAKE_US          340     // warm wake until BUSY falls
+#define SIM_SLEEP_ENTRY_US        500     // after SetSleep, an NSS edge before this is lost and the chip stays asleep
+#define SIM_RX_TIMEOUT_STEP_NS    15625   // SetRx/SetTx timeout LSB
+#define SIM_SNIFF_DETECT_SYMBOLS  4       // preamble symbols a RX duty cycle window needs to lock on
+
+
+SX126xSim::SX126xSim(void)
+{
+  for ( uint16_t i = 0; i < 256; i++ ) {
+    busyTimeUs[i] = SIM_BUSY_DEFAULT_US;
+  }
+  busyTimeUs[SX126X_CMD_SET_FS]                   = 50;
+  busyTimeUs[SX126X_CMD_SET_TX]                   = 120;
+  busyTimeUs[SX126X_CMD_SET_RX]                   = 85;
+  busyTimeUs[SX126X_CMD_SET_RX_DUTY_CYCLE]        = 85;
+  busyTimeUs[SX126X_CMD_CALIBRATE]                = 3500;
+  busyTimeUs[SX126X_CMD_CALIBRATE_IMAGE]          = 1500;
+  busyTimeUs[SX126X_CMD_SET_DIO3_AS_TCXO_CTRL]    = 10;
+  busyTimeUs[SX126X_CMD_SET_RF_FREQUENCY]         = 10;
+
+  now         = 0;
+  busyUntil   = 0;
+  pollCostUs  = 1;
+  spiByteUs   = 1;
+  nssLow      = false;
+  inReset     = false;
+  asleep      = false;
+  warmSleep   = false;
+  sleepAt     = 0;
+  isr         = nullptr;
+  dio1Level   = false;
+  pendingEdge = false;
+  inIsr       = false;
+  edgeTime    = 0;
+  dutyStart   = 0;
+  dutyRxUs    = 0;
+  dutySleepUs = 0;
+  channelBusyUntil = 0;
+  rxEnd       = 0;
+
+  ColdStart();
+  ResetCounters();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  SX126xHal
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126xSim::Begin(void)
+{
+}
+
+
+void SX126xSim::SpiBegin(void)
+{
+  nssLow = true;
+  cmd.clear();
+  counters.spiTransactions++;
+
+  if ( asleep && now - sleepAt < SIM_SLEEP_ENTRY_US )
+  {
+    // still on its way into sleep, the edge does not wake the chip and BUSY stays high
+    counters.wakesLost++;
+    wakeTransaction = true;
+  }
+  else if ( asleep )
+  {
+    // a falling edge on NSS wakes the chip, the command itself is lost
+    asleep = false;
+    if ( !warmSleep ) {
+      ColdStart();
+    }
+    mode = SX126X_STATUS_MODE_STDBY_RC;
+    busyUntil = now + (warmSleep ? SIM_WARM_WAKE_US : SIM_BOOT_US);
+    cmd.push_back(SX126X_CMD_NOP);
+    wakeTransaction = true;
+  }
+  else
+  {
+    wakeTransaction = false;
+    if ( now < busyUntil || inReset ) {
+      counters.busyViolations++;
+    }
+  }
+}
+
+
+void SX126xSim::SpiEnd(void)
+{
+  nssLow = false;
+
+  if ( !wakeTransaction && !cmd.empty() && !inReset && now >= busyUntil ) {
+    Execute();
+  }
+
+  DeliverIsr();
+}
+
+
+uint8_t SX126xSim::SpiTransfer(uint8_t data)
+{
+  counters.spiBytes++;
+  Advance(spiByteUs);
+
+  if ( wakeTransaction ) {
+    return 0x00;
+  }
+
+  uint16_t index = cmd.size();
+  cmd.push_back(data);
+  return Respond(index);
+}
+
+
+bool SX126xSim::ReadBusy(void)
+{
+  counters.busyPolls++;
+
+  if ( now < busyUntil || inReset )
+  {
+    counters.busyStalls++;
+    counters.busyStallUs += pollCostUs;
+    Advance(pollCostUs);
+    return true;
+  }
+
+  return false;
+}
+
+
+void SX126xSim::WriteReset(bool level)
+{
+  if ( !level )
+  {
+    inReset = true;
+    CancelEvents();
+    busyUntil = SIM_BUSY_FOREVER;
+  }
+  else if ( inReset )
+  {
+    inReset = false;
+    asleep = false;
+    ColdStart();
+    busyUntil = now + SIM_BOOT_US;
+  }
+}
+
+
+void SX126xSim::DelayMicroseconds(uint32_t us)
+{
+  Advance(us);
+}
+
+
+void SX126xSim::Yield(void)
+{
+  Advance(pollCostUs);
+}
+
+
+uint32_t SX126xSim::Micros(void)
+{
+  return (uint32_t)now;
+}
+
+
+uint32_t SX126xSim::Millis(void)
+{
+  return (uint32_t)(now / 1000);
+}
+
+
+void SX126xSim::AttachDio1(void (*handler)(void))
+{
+  isr = handler;
+}
+
+
+void SX126xSim::DetachDio1(void)
+{
+  isr = nullptr;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  simulation control
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126xSim::Run(uint32_t us)
+{
+  Advance(us);
+}
+
+
+uint64_t SX126xSim::Now(void) const
+{
+  return now;
+}
+
+
+bool SX126xSim::InjectPacket(const uint8_t* data, uint8_t len, int16_t rssiInDbm, int8_t snrInDb, bool crcError)
+{
+  SetChannelBusy(TimeOnAir(len));
+
+  if ( mode != SX126X_STATUS_MODE_RX || rxPending )
+  {
+    counters.rxMissed++;
+    return false;
+  }
+
+  // the packet's preamble starts now, with RX duty cycle it is only heard if a window overlaps enough of it
+  if ( rxDutyCycle && !SniffDetects() )
+  {
+    counters.rxMissed++;
+    return false;
+  }
+
+  rxPacket.data.assign(data, data + len);
+  rxPacket.rssi = rssiInDbm;
+  rxPacket.snr = snrInDb;
+  rxPacket.crcError = crcError;
+  rxPending = true;
+
+  // the RX timeout timer stops once a header has been detected
+  for ( size_t i = 0; i < events.size(); ) {
+    if ( events[i].type == EV_RX_TIMEOUT ) {
+      events.erase(events.begin() + i);
+    }
+    else {
+      i++;
+    }
+  }
+
+  // during a CAD the packet is only received if the CAD switches to RX
+  rxEnd = now + TimeOnAir(len);
+  if ( !cadActive ) {
+    Schedule(rxEnd, EV_RX_DONE);
+  }
+  return true;
+}
+
+
+uint32_t SX126xSim::TimeOnAir(uint8_t payloadLen) const
+{
+  if ( packetType == SX126X_PACKET_TYPE_LORA )
+  {
+    static const uint32_t bandwidths[16] = { 7810, 15630, 31250, 62500, 125000, 250000, 500000, 0,
+                                             10420, 20830, 41670, 0, 0, 0, 0, 0 };
+    int sf = modulationParams[0];
+    uint32_t bw = bandwidths[modulationParams[1] & 0x0F];
+    int cr = modulationParams[2];
+    bool ldro = modulationParams[3];
+    int preamble = (packetParams[0] << 8) | packetParams[1];
+    bool implicit = packetParams[2] == SX126X_LORA_HEADER_IMPLICIT;
+    bool crc = packetParams[4] == SX126X_LORA_CRC_ON;
+
+    if ( bw == 0 || sf < 5 || sf > 12 ) {
+      return 0;
+    }
+
+    double symbols;
+    int bits = 8 * payloadLen + (crc ? 16 : 0) - 4 * sf + (implicit ? 0 : 20);
+    if ( sf < 7 ) {
+      symbols = preamble + 6.25 + 8 + ceil((bits > 0 ? bits : 0) / (4.0 * sf)) * (cr + 4);
+    }
+    else {
+      bits += 8;
+      double denom = ldro ? 4.0 * (sf - 2) : 4.0 * sf;
+      symbols = preamble + 4.25 + 8 + ceil((bits > 0 ? bits : 0) / denom) * (cr + 4);
+    }
+    return (uint32_t)(symbols * (double)(1 << sf) * 1e6 / bw);
+  }
+
+  // GFSK
+  uint32_t brReg = ((uint32_t)modulationParams[0] << 16) | ((uint32_t)modulationParams[1] << 8) | modulationParams[2];
+  if ( brReg == 0 ) {
+    return 0;
+  }
+  double bitRate = 32.0 * 32000000.0 / brReg;
+  uint32_t bits = ((packetParams[0] << 8) | packetParams[1]) + packetParams[3] + 8 * payloadLen;
+  if ( packetParams[5] == SX126X_GFSK_PACKET_VARIABLE ) {
+    bits += 8;
+  }
+  if ( packetParams[4] != SX126X_GFSK_ADDRESS_FILT_OFF ) {
+    bits += 8;
+  }
+  if ( packetParams[7] == SX126X_GFSK_CRC_2_BYTE || packetParams[7] == SX126X_GFSK_CRC_2_BYTE_INV ) {
+    bits += 16;
+  }
+  else if ( packetParams[7] != SX126X_GFSK_CRC_OFF ) {
+    bits += 8;
+  }
+  return (uint32_t)(bits * 1e6 / bitRate);
+}
+
+
+// another transmitter occupies the channel for the next us microseconds
+void SX126xSim::SetChannelBusy(uint32_t us)
+{
+  if ( now + us > channelBusyUntil ) {
+    channelBusyUntil = now + us;
+  }
+}
+
+
+void SX126xSim::SetBusyTime(uint8_t command, uint32_t us)
+{
+  busyTimeUs[command] = us;
+}
+
+
+void SX126xSim::SetPollCost(uint32_t us)
+{
+  pollCostUs = us;
+}
+
+
+void SX126xSim::SetSpiByteTime(uint32_t us)
+{
+  spiByteUs = us;
+}
+
+
+void SX126xSim::ResetCounters(void)
+{
+  memset(&counters, 0, sizeof(counters));
+}
+
+
+uint8_t SX126xSim::Mode(void) const
+{
+  return mode;
+}
+
+
+uint16_t SX126xSim::IrqStatus(void) const
+{
+  return irqStatus;
+}
+
+
+bool SX126xSim::Dio1(void) const
+{
+  return dio1Level;
+}
+
+
+const uint8_t* SX126xSim::Buffer(void) const
+{
+  return buffer;
+}
+
+
+uint8_t SX126xSim::Register(uint16_t address) const
+{
+  return registers[address & 0x0FFF];
+}
+
+
+uint32_t SX126xSim::Frequency(void) const
+{
+  return rfFrequency;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  model internals
+//----------------------------------------------------------------------------------------------------------------------------
+void SX126xSim::Advance(uint64_t us)
+{
+  uint64_t target = now + us;
+
+  for (;;)
+  {
+    size_t next = events.size();
+    for ( size_t i = 0; i < events.size(); i++ ) {
+      if ( events[i].time <= target && (next == events.size() || events[i].time < events[next].time) ) {
+        next = i;
+      }
+    }
+    if ( next == events.size() ) {
+      break;
+    }
+
+    Event ev = events[next];
+    events.erase(events.begin() + next);
+    if ( ev.time > now ) {
+      now = ev.time;
+    }
+    Process(ev);
+
+    // time spent in an ISR delivered by this event delays the caller as well
+    if ( now > target ) {
+      target = now;
+    }
+  }
+
+  now = target;
+}
+
+
+void SX126xSim::Schedule(uint64_t time, EventType type)
+{
+  Event ev = { time, type };
+  events.push_back(ev);
+}
+
+
+void SX126xSim::CancelEvents(void)
+{
+  events.clear();
+  rxPending = false;
+  rxDutyCycle = false;
+  cadActive = false;
+}
+
+
+void SX126xSim::Process(const Event& ev)
+{
+  switch ( ev.type )
+  {
+    case EV_TX_DONE:
+      if ( mode == SX126X_STATUS_MODE_TX ) {
+        Fallback();
+        cmdStatus = SX126X_STATUS_TX_DONE;
+        RaiseIrq(SX126X_IRQ_TX_DONE);
+      }
+      break;
+
+    case EV_TX_TIMEOUT:
+    case EV_RX_TIMEOUT:
+      if ( mode == SX126X_STATUS_MODE_TX || mode == SX126X_STATUS_MODE_RX ) {
+        rxPending = false;
+        Fallback();
+        cmdStatus = SX126X_STATUS_CMD_TIMEOUT;
+        RaiseIrq(SX126X_IRQ_TIMEOUT);
+      }
+      break;
+
+    // CAD always ends in STDBY_RC unless it detected activity with exit mode CAD_RX
+    case EV_CAD_DONE:
+      if ( cadActive )
+      {
+        cadActive = false;
+        bool detected = now < channelBusyUntil;
+        counters.cads++;
+        if ( detected ) {
+          counters.cadDetections++;
+        }
+
+        if ( detected && cadParams[3] == SX126X_CAD_GOTO_RX )
+        {
+          uint32_t timeout = ((uint32_t)cadParams[4] << 16) | ((uint32_t)cadParams[5] << 8) | cadParams[6];
+          rxContinuous = false;
+          if ( rxPending ) {
+            Schedule(rxEnd, EV_RX_DONE);
+          }
+          else {
+            Schedule(now + (uint64_t)timeout * SIM_RX_TIMEOUT_STEP_NS / 1000, EV_RX_TIMEOUT);
+          }
+        }
+        else
+        {
+          if ( rxPending ) {
+            rxPending = false;
+            counters.rxMissed++;
+          }
+          mode = SX126X_STATUS_MODE_STDBY_RC;
+        }
+        RaiseIrq(SX126X_IRQ_CAD_DONE | (detected ? SX126X_IRQ_CAD_DETECTED : 0));
+      }
+      break;
+
+    case EV_RX_DONE:
+      if ( mode == SX126X_STATUS_MODE_RX && rxPending )
+      {
+        rxPending = false;
+        rxStart = rxBase;
+        rxLength = rxPacket.data.size();
+        for ( uint16_t i = 0; i < rxLength; i++ ) {
+          buffer[(uint8_t)(rxBase + i)] = rxPacket.data[i];
+        }
+        lastRssi = rxPacket.rssi;
+        lastSnr = rxPacket.snr;
+        counters.rxFrames++;
+        statsReceived++;
+        if ( rxPacket.crcError ) {
+          statsCrcErrors++;
+        }
+
+        if ( !rxContinuous ) {
+          Fallback();
+        }
+        cmdStatus = SX126X_STATUS_DATA_AVAILABLE;
+
+        uint16_t irq = SX126X_IRQ_PREAMBLE_DETECTED | SX126X_IRQ_HEADER_VALID | SX126X_IRQ_RX_DONE;
+        if ( rxPacket.crcError ) {
+          irq |= SX126X_IRQ_CRC_ERR;
+        }
+        RaiseIrq(irq);
+      }
+      break;
+  }
+}
+
+
+void SX126xSim::Execute(void)
+{
+  uint8_t op = cmd[0];
+  const uint8_t* p = cmd.data() + 1;
+  size_t n = cmd.size() - 1;
+
+  busyUntil = now + busyTimeUs[op];
+
+  switch ( op )
+  {
+    case SX126X_CMD_SET_SLEEP:
+      CancelEvents();
+      asleep = true;
+      sleepAt = now;
+      warmSleep = n > 0 && (p[0] & SX126X_SLEEP_START_WARM);
+      mode = 0;
+      busyUntil = SIM_BUSY_FOREVER;
+      break;
+
+    case SX126X_CMD_SET_STANDBY:
+      CancelEvents();
+      mode = (n > 0 && p[0] == SX126X_STANDBY_XOSC) ? SX126X_STATUS_MODE_STDBY_XOSC : SX126X_STATUS_MODE_STDBY_RC;
+      break;
+
+    case SX126X_CMD_SET_FS:
+      CancelEvents();
+      mode = SX126X_STATUS_MODE_FS;
+      break;
+
+    case SX126X_CMD_SET_TX:
+      if ( n >= 3 )
+      {
+        CancelEvents();
+        mode = SX126X_STATUS_MODE_TX;
+
+        uint8_t len = (packetType == SX126X_PACKET_TYPE_LORA) ? packetParams[3] : packetParams[6];
+        uint64_t start = busyUntil;
+        uint64_t timeout = (uint64_t)((p[0] << 16) | (p[1] << 8) | p[2]) * SIM_RX_TIMEOUT_STEP_NS / 1000;
+        uint64_t toa = TimeOnAir(len);
+
+        if ( timeout != 0 && timeout < toa ) {
+          Schedule(start + timeout, EV_TX_TIMEOUT);
+        }
+        else {
+          Schedule(start + toa, EV_TX_DONE);
+        }
+
+        counters.txFrames++;
+        if ( OnTransmit ) {
+          uint8_t frame[256];
+          for ( uint16_t i = 0; i < len; i++ ) {
+            frame[i] = buffer[(uint8_t)(txBase + i)];
+          }
+          OnTransmit(frame, len);
+        }
+      }
+      break;
+
+    case SX126X_CMD_SET_RX:
+      if ( n >= 3 )
+      {
+        CancelEvents();
+        mode = SX126X_STATUS_MODE_RX;
+
+        uint32_t timeout = (p[0] << 16) | (p[1] << 8) | p[2];
+        rxContinuous = (timeout == SX126X_RX_NO_TIMEOUT_CONT);
+        if ( timeout != SX126X_RX_NO_TIMEOUT_CONT && timeout != SX126X_RX_NO_TIMEOUT_SINGLE ) {
+          Schedule(busyUntil + (uint64_t)timeout * SIM_RX_TIMEOUT_STEP_NS / 1000, EV_RX_TIMEOUT);
+        }
+      }
+      break;
+
+    case SX126X_CMD_SET_RX_DUTY_CYCLE:
+      if ( n >= 6 )
+      {
+        CancelEvents();
+        mode = SX126X_STATUS_MODE_RX;
+        rxContinuous = false;
+        rxDutyCycle = true;
+        dutyStart = busyUntil;
+        dutyRxUs = (uint64_t)((p[0] << 16) | (p[1] << 8) | p[2]) * SIM_RX_TIMEOUT_STEP_NS / 1000;
+        dutySleepUs = (uint64_t)((p[3] << 16) | (p[4] << 8) | p[5]) * SIM_RX_TIMEOUT_STEP_NS / 1000;
+      }
+      break;
+
+    case SX126X_CMD_SET_CAD_PARAMS:
+      memcpy(cadParams, p, n < sizeof(cadParams) ? n : sizeof(cadParams));
+      break;
+
+    // the chip reports RX while it runs a CAD over 2^cadSymbolNum symbols, plus one symbol to process them
+    case SX126X_CMD_SET_CAD:
+      if ( packetType == SX126X_PACKET_TYPE_LORA )
+      {
+        CancelEvents();
+        mode = SX126X_STATUS_MODE_RX;
+        cadActive = true;
+        Schedule(busyUntil + (((uint64_t)1 << (cadParams[0] & 0x07)) + 1) * SymbolTimeUs(), EV_CAD_DONE);
+      }
+      break;
+
+    case SX126X_CMD_SET_PACKET_TYPE:
+      if ( n >= 1 ) {
+        packetType = p[0];
+      }
+      break;
+
+    case SX126X_CMD_SET_MODULATION_PARAMS:
+      memcpy(modulationParams, p, n < sizeof(modulationParams) ? n : sizeof(modulationParams));
+      break;
+
+    case SX126X_CMD_SET_PACKET_PARAMS:
+      memcpy(packetParams, p, n < sizeof(packetParams) ? n : sizeof(packetParams));
+      break;
+
+    case SX126X_CMD_SET_RF_FREQUENCY:
+      if ( n >= 4 ) {
+        rfFrequency = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+      }
+      break;
+
+    case SX126X_CMD_SET_BUFFER_BASE_ADDRESS:
+      if ( n >= 2 ) {
+        txBase = p[0];
+        rxBase = p[1];
+      }
+      break;
+
+    case SX126X_CMD_WRITE_BUFFER:
+      for ( size_t i = 1; i < n; i++ ) {
+        buffer[(uint8_t)(p[0] + i - 1)] = p[i];
+      }
+      break;
+
+    case SX126X_CMD_WRITE_REGISTER:
+      for ( size_t i = 2; i < n; i++ ) {
+        registers[((p[0] << 8) + p[1] + i - 2) & 0x0FFF] = p[i];
+      }
+      break;
+
+    case SX126X_CMD_SET_DIO_IRQ_PARAMS:
+      if ( n >= 4 ) {
+        irqMask = (p[0] << 8) | p[1];
+        dio1Mask = (p[2] << 8) | p[3];
+        UpdateDio1();
+      }
+      break;
+
+    case SX126X_CMD_CLEAR_IRQ_STATUS:
+      if ( n >= 2 ) {
+        irqStatus &= ~((p[0] << 8) | p[1]);
+        UpdateDio1();
+      }
+      break;
+
+    case SX126X_CMD_CLEAR_DEVICE_ERRORS:
+      deviceErrors = 0;
+      break;
+
+    case SX126X_CMD_SET_RX_TX_FALLBACK_MODE:
+      if ( n >= 1 ) {
+        fallbackMode = p[0];
+      }
+      break;
+
+    case SX126X_CMD_RESET_STATS:
+      if ( n >= 6 ) 
+      {
+        statsReceived = 0;
+        statsCrcErrors = 0;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+uint8_t SX126xSim::Respond(uint16_t index)
+{
+  uint8_t op = cmd[0];
+
+  if ( index == 0 || op == SX126X_CMD_GET_STATUS ) {
+    return StatusByte();
+  }
+
+  if ( op == SX126X_CMD_READ_BUFFER ) {
+    return (index < 3) ? StatusByte() : buffer[(uint8_t)(cmd[1] + index - 3)];
+  }
+
+  if ( op == SX126X_CMD_READ_REGISTER ) {
+    return (index < 4) ? StatusByte() : registers[((cmd[1] << 8) + cmd[2] + index - 4) & 0x0FFF];
+  }
+
+  if ( index == 1 ) {
+    return StatusByte();
+  }
+
+  uint8_t data[6] = { 0, 0, 0, 0, 0, 0 };
+
+  switch ( op )
+  {
+    case SX126X_CMD_GET_IRQ_STATUS:
+      data[0] = irqStatus >> 8;
+      data[1] = irqStatus & 0xFF;
+      break;
+
+    case SX126X_CMD_GET_RX_BUFFER_STATUS:
+      data[0] = rxLength;
+      data[1] = rxStart;
+      break;
+
+    case SX126X_CMD_GET_PACKET_STATUS:
+      if ( packetType == SX126X_PACKET_TYPE_LORA ) {
+        int16_t signal = (lastSnr < 0) ? lastRssi + lastSnr : lastRssi;
+        data[0] = (uint8_t)(-2 * lastRssi);
+        data[1] = (uint8_t)(int8_t)(lastSnr * 4);
+        data[2] = (uint8_t)(-2 * signal);
+      }
+      else {
+        data[0] = SX126X_GFSK_RX_STATUS_PACKET_RECEIVED;
+        data[1] = (uint8_t)(-2 * lastRssi);
+        data[2] = (uint8_t)(-2 * lastRssi);
+      }
+      break;
+
+    case SX126X_CMD_GET_DEVICE_ERRORS:
+      data[0] = deviceErrors >> 8;
+      data[1] = deviceErrors & 0xFF;
+      break;
+
+    case SX126X_CMD_GET_PACKET_TYPE:
+      data[0] = packetType;
+      break;
+
+    // the model produces no header or length errors
+    case SX126X_CMD_GET_STATS:
+      data[0] = statsReceived >> 8;
+      data[1] = statsReceived & 0xFF;
+      data[2] = statsCrcErrors >> 8;
+      data[3] = statsCrcErrors & 0xFF;
+      break;
+
+    case SX126X_CMD_GET_RSSI_INST:
+      data[0] = (uint8_t)(-2 * lastRssi);
+      break;
+
+    default:
+      return StatusByte();
+  }
+
+  return (index - 2 < 6) ? data[index - 2] : 0;
+}
+
+
+uint8_t SX126xSim::StatusByte(void) const
+{
+  return (mode & 0x70) | (cmdStatus & 0x0E);
+}
+
+
+void SX126xSim::RaiseIrq(uint16_t irq)
+{
+  irqStatus |= irq & irqMask;
+  UpdateDio1();
+}
+
+
+void SX126xSim::UpdateDio1(void)
+{
+  bool level = (irqStatus & dio1Mask) != 0;
+
+  if ( level && !dio1Level )
+  {
+    counters.dio1Edges++;
+    pendingEdge = true;
+    edgeTime = now;
+  }
+  dio1Level = level;
+
+  DeliverIsr();
+}
+
+
+void SX126xSim::DeliverIsr(void)
+{
+  while ( pendingEdge && isr != nullptr && !inIsr && !nssLow )
+  {
+    pendingEdge = false;
+
+    uint64_t latency = now - edgeTime;
+    counters.isrLatencyUs += latency;
+    if ( latency > counters.isrMaxLatencyUs ) {
+      counters.isrMaxLatencyUs = latency;
+    }
+
+    uint64_t start = now;
+    inIsr = true;
+    isr();
+    inIsr = false;
+
+    uint64_t duration = now - start;
+    counters.isrCount++;
+    counters.isrTimeUs += duration;
+    if ( duration > counters.isrMaxUs ) {
+      counters.isrMaxUs = duration;
+    }
+  }
+}
+
+
+void SX126xSim::ColdStart(void)
+{
+  CancelEvents();
+
+  memset(buffer, 0, sizeof(buffer));
+  memset(registers, 0, sizeof(registers));
+  memset(modulationParams, 0, sizeof(modulationParams));
+  memset(packetParams, 0, sizeof(packetParams));
+
+  registers[SX126X_REG_LORA_SYNC_WORD_MSB] = (SX126X_SYNC_WORD_PRIVATE >> 8) & 0xFF;
+  registers[SX126X_REG_LORA_SYNC_WORD_LSB] = SX126X_SYNC_WORD_PRIVATE & 0xFF;
+  registers[SX126X_REG_OCP_CONFIGURATION] = 0x38;
+
+  mode          = SX126X_STATUS_MODE_STDBY_RC;
+  cmdStatus     = 0;
+  packetType    = SX126X_PACKET_TYPE_GFSK;
+  rfFrequency   = 0;
+  txBase        = 0;
+  rxBase        = 0;
+  rxLength      = 0;
+  rxStart       = 0;
+  irqStatus     = 0;
+  irqMask       = 0;
+  dio1Mask      = 0;
+  deviceErrors  = 0;
+  fallbackMode  = SX126X_RX_TX_FALLBACK_MODE_STDBY_RC;
+  rxContinuous  = false;
+  rxPending     = false;
+  lastRssi      = 0;
+  lastSnr       = 0;
+  statsReceived = 0;
+  statsCrcErrors = 0;
+  wakeTransaction = false;
+  memset(cadParams, 0, sizeof(cadParams));
+
+  UpdateDio1();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  RX duty cycle: a LoRa preamble starting now is detected if one of the RX windows (rx period every rx + sleep period,
+//  starting at dutyStart) covers at least SIM_SNIFF_DETECT_SYMBOLS of its symbols.
+//----------------------------------------------------------------------------------------------------------------------------
+bool SX126xSim::SniffDetects(void) const
+{
+  uint64_t symbolUs = SymbolTimeUs();
+  if ( packetType != SX126X_PACKET_TYPE_LORA || symbolUs == 0 ) {
+    return true;
+  }
+
+  uint64_t preambleEnd = now + (((uint64_t)packetParams[0] << 8) | packetParams[1]) * symbolUs;
+  uint64_t period = dutyRxUs + dutySleepUs;
+
+  uint64_t k = (now > dutyStart) ? (now - dutyStart) / period : 0;
+  for ( ; dutyStart + k * period < preambleEnd; k++ )
+  {
+    uint64_t windowStart = dutyStart + k * period;
+    uint64_t from = (windowStart > now) ? windowStart : now;
+    uint64_t to = (windowStart + dutyRxUs < preambleEnd) ? windowStart + dutyRxUs : preambleEnd;
+    if ( to > from && to - from >= SIM_SNIFF_DETECT_SYMBOLS * symbolUs ) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+uint64_t SX126xSim::SymbolTimeUs(void) const
+{
+  static const uint32_t bandwidths[16] = { 7810, 15630, 31250, 62500, 125000, 250000, 500000, 0,
+                                           10420, 20830, 41670, 0, 0, 0, 0, 0 };
+  uint32_t bw = bandwidths[modulationParams[1] & 0x0F];
+  if ( bw == 0 ) {
+    return 0;
+  }
+  return ((uint64_t)1 << modulationParams[0]) * 1000000 / bw;
+}
+
+
+void SX126xSim::Fallback(void)
+{
+  rxDutyCycle = false;
+
+  switch ( fallbackMode )
+  {
+    case SX126X_RX_TX_FALLBACK_MODE_FS:
+      mode = SX126X_STATUS_MODE_FS;
+      break;
+
+    case SX126X_RX_TX_FALLBACK_MODE_STDBY_XOSC:
+      mode = SX126X_STATUS_MODE_STDBY_XOSC;
+      break;
+
+    default:
+      mode = SX126X_STATUS_MODE_STDBY_RC;
+      break;
+  }
+}
@@ -0,0 +1,177 @@
+#ifndef _SX126X_SIM_H
+#define _SX126X_SIM_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "SX126xHal.h"
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Behavioral model of a SX126x for host (Linux) builds of the driver.
+//
+//  The model implements SX126xHal, so a driver instance created with SX126x(&sim) talks to it exactly as it would talk to
+//  the Arduino SPI/GPIO backend. It decodes the SPI command stream and tracks the chip mode, the 256 byte data buffer,
+//  IRQ status and masks, register contents and the BUSY line. Time is virtual: it only advances when the driver waits
+//  (BUSY polls, delays, Yield), while SPI bytes are clocked (1 us per byte at the default 8 MHz) or when the host calls
+//  Run(). TX completion, RX timeouts and injected packets are scheduled on that clock from the configured modulation, and
+//  every rising edge of DIO1 calls the ISR the driver attached. An edge that happens while NSS is low or while the ISR is
+//  already running is latched and delivered as soon as the transaction or the ISR ends, the same way a MCU keeps the
+//  interrupt pending.
+//
+//  SetChannelBusy() and InjectPacket() put other transmissions on the channel; a CAD that ends while the channel is busy
+//  reports CAD_DETECTED.
+//
+//  Counters collects what the driver costs: SPI transactions and bytes, BUSY stalls, DIO1 edges and the time spent in
+//  and waiting for the ISR.
+//----------------------------------------------------------------------------------------------------------------------------
+class SX126xSim : public SX126xHal {
+
+  public:
+    struct Counters {
+      uint32_t  spiTransactions;
+      uint32_t  spiBytes;
+      uint32_t  busyPolls;
+      uint32_t  busyStalls;        // polls that found BUSY high
+      uint64_t  busyStallUs;       // virtual time spent polling a high BUSY line
+      uint32_t  dio1Edges;
+      uint32_t  isrCount;
+      uint64_t  isrTimeUs;         // virtual time spent inside the ISR
+      uint32_t  isrMaxUs;
+      uint64_t  isrLatencyUs;      // edge to ISR entry
+      uint32_t  isrMaxLatencyUs;
+      uint32_t  txFrames;
+      uint32_t  rxFrames;
+      uint32_t  rxMissed;          // injected while the model was not listening
+      uint32_t  cads;
+      uint32_t  cadDetections;
+      uint32_t  busyViolations;    // transactions started while BUSY was high
+      uint32_t  wakesLost;         // NSS edges that came while the chip was still entering sleep
+    };
+
+    SX126xSim(void);
+
+    // SX126xHal
+    void      Begin(void);
+    void      SpiBegin(void);
+    void      SpiEnd(void);
+    uint8_t   SpiTransfer(uint8_t data);
+    bool      ReadBusy(void);
+    void      WriteReset(bool level);
+    void      DelayMicroseconds(uint32_t us);
+    void      Yield(void);
+    uint32_t  Micros(void);
+    uint32_t  Millis(void);
+    void      AttachDio1(void (*isr)(void));
+    void      DetachDio1(void);
+
+    // simulation control
+    void      Run(uint32_t us);
+    uint64_t  Now(void) const;
+    bool      InjectPacket(const uint8_t* data, uint8_t len, int16_t rssiInDbm = -60, int8_t snrInDb = 8, bool crcError = false);
+    uint32_t  TimeOnAir(uint8_t payloadLen) const;
+    void      SetChannelBusy(uint32_t us);
+    void      SetBusyTime(uint8_t cmd, uint32_t us);
+    void      SetPollCost(uint32_t us);
+    void      SetSpiByteTime(uint32_t us);
+    void      ResetCounters(void);
+
+    uint8_t   Mode(void) const;
+    uint16_t  IrqStatus(void) const;
+    bool      Dio1(void) const;
+    const uint8_t* Buffer(void) const;
+    uint8_t   Register(uint16_t address) const;
+    uint32_t  Frequency(void) const;
+
+    // called with every frame the model puts on air
+    std::function<void(const uint8_t* data, uint8_t len)> OnTransmit;
+
+    Counters  counters;
+
+  private:
+    enum EventType { EV_TX_DONE, EV_TX_TIMEOUT, EV_RX_DONE, EV_RX_TIMEOUT, EV_CAD_DONE };
+
+    struct Event {
+      uint64_t  time;
+      EventType type;
+    };
+
+    struct Packet {
+      std::vector<uint8_t> data;
+      int16_t   rssi;
+      int8_t    snr;
+      bool      crcError;
+    };
+
+    void      Advance(uint64_t us);
+    void      Schedule(uint64_t time, EventType type);
+    void      CancelEvents(void);
+    void      Process(const Event& ev);
+    void      Execute(void);
+    uint8_t   Respond(uint16_t index);
+    uint8_t   StatusByte(void) const;
+    void      RaiseIrq(uint16_t irq);
+    void      UpdateDio1(void);
+    void      DeliverIsr(void);
+    void      ColdStart(void);
+    void      Fallback(void);
+    bool      SniffDetects(void) const;
+    uint64_t  SymbolTimeUs(void) const;
+
+    uint64_t  now;
+    uint64_t  busyUntil;
+    uint32_t  pollCostUs;
+    uint32_t  spiByteUs;
+    uint32_t  busyTimeUs[256];
+
+    uint8_t   mode;
+    uint8_t   cmdStatus;
+    bool      nssLow;
+    bool      inReset;
+    bool      asleep;
+    bool      warmSleep;
+    uint64_t  sleepAt;
+    bool      wakeTransaction;
+
+    std::vector<uint8_t> cmd;
+    std::vector<Event>   events;
+
+    void      (*isr)(void);
+    bool      dio1Level;
+    bool      pendingEdge;
+    bool      inIsr;
+    uint64_t  edgeTime;
+
+    uint8_t   buffer[256];
+    uint8_t   registers[0x1000];
+    uint8_t   packetType;
+    uint8_t   modulationParams[8];
+    uint8_t   packetParams[9];
+    uint32_t  rfFrequency;
+    uint8_t   txBase;
+    uint8_t   rxBase;
+    uint8_t   rxLength;
+    uint8_t   rxStart;
+    uint16_t  irqStatus;
+    uint16_t  irqMask;
+    uint16_t  dio1Mask;
+    uint16_t  deviceErrors;
+    uint8_t   fallbackMode;
+    bool      rxContinuous;
+    bool      rxDutyCycle;
+    uint64_t  dutyStart;
+    uint64_t  dutyRxUs;
+    uint64_t  dutySleepUs;
+    uint8_t   cadParams[7];
+    bool      cadActive;
+    uint64_t  channelBusyUntil;
+    Packet    rxPacket;
+    bool      rxPending;
+    uint64_t  rxEnd;
+    int16_t   lastRssi;
+    int8_t    lastSnr;
+    uint16_t  statsReceived;
+    uint16_t  statsCrcErrors;
+};
+
+#endif
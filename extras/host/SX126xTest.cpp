@@ -0,0 +1,658 @@
+//----------------------------------------------------------------------------------------------------------------------------
+//  Checks what the driver's modes and protocols do when run against SX126xSim, as opposed to SX126xBenchmark.cpp, which
+//  measures what they cost. Protocol checks connect two driver instances back to back: every frame one model puts on air
+//  is injected into the other one once it listens on the same frequency, unless the check drops it on the way.
+//
+//  Each check prints one line starting with "ok" or "FAIL"; the exit status is the number of failed checks:
+//
+//    g++ -std=c++11 -O2 -I. -Iextras/host SX126x.cpp SX126xHal.cpp SX126xDual.cpp extras/host/SX126xSim.cpp extras/host/SX126xTest.cpp -o sx126x_test
+//    ./sx126x_test
+//----------------------------------------------------------------------------------------------------------------------------
+#include "SX126xDual.h"
+#include "SX126xSim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+
+#define TEST_FREQUENCY_HZ       868100000
+#define TEST_TX_POWER_DBM       14
+#define TEST_STEP_US            50
+#define TEST_AIR_WINDOW_US      8000          // a receiver that enters RX this late still gets the frame
+
+
+// frame on its way from one model to the other
+struct Frame {
+  SX126xSim* to;
+  std::vector<uint8_t> data;
+  uint64_t  until;
+  uint32_t  frequency;                        // frequency word of the sender
+  uint8_t   rate;                             // sender's link rate, for checks that model a fading link
+  int8_t    snr;
+};
+
+static std::vector<Frame> air;
+static std::function<bool(const uint8_t* data, uint8_t len)> drop;       // true: the frame is lost on the way
+static std::function<void(Frame& frame)> onAir;                          // fills in what a check needs to know
+static std::function<bool(const Frame& frame)> audible;                  // false: the receiver can not hear it now
+static int failures;
+
+
+static void Check(const char* name, bool passed)
+{
+  printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+  if ( !passed ) {
+    failures++;
+  }
+}
+
+
+static void Connect(SX126xSim* from, SX126xSim* to)
+{
+  from->OnTransmit = [from, to](const uint8_t* data, uint8_t len)
+  {
+    if ( drop && drop(data, len) ) {
+      return;
+    }
+    Frame frame = { to, std::vector<uint8_t>(data, data + len), to->Now() + TEST_AIR_WINDOW_US, from->Frequency(), 0, 8 };
+    if ( onAir ) {
+      onAir(frame);
+    }
+    air.push_back(frame);
+  };
+}
+
+
+// hands the frames on air to their receivers, a frame nobody picked up in time is lost
+static void Deliver(void)
+{
+  for ( size_t i = 0; i < air.size(); )
+  {
+    Frame& frame = air[i];
+    bool heard = frame.to->Mode() == SX126X_STATUS_MODE_RX && frame.to->Frequency() == frame.frequency &&
+                 (!audible || audible(frame));
+    if ( heard && frame.to->InjectPacket(frame.data.data(), frame.data.size(), -117 + frame.snr, frame.snr) ) {
+      air.erase(air.begin() + i);
+    }
+    else if ( frame.to->Now() > frame.until ) {
+      air.erase(air.begin() + i);
+    }
+    else {
+      i++;
+    }
+  }
+}
+
+
+// two radios on one channel, each hears the other
+struct Link {
+  SX126xSim simA;
+  SX126xSim simB;
+  SX126x    a;
+  SX126x    b;
+
+  Link(void) : a(&simA), b(&simB)
+  {
+    air.clear();
+    drop = nullptr;
+    onAir = nullptr;
+    audible = nullptr;
+    Connect(&simA, &simB);
+    Connect(&simB, &simA);
+  }
+
+  bool LoRa(uint8_t spreadingFactor, uint8_t bandwidth)
+  {
+    for ( SX126x* radio : { &a, &b } )
+    {
+      if ( radio->ModuleConfig(SX126X_PACKET_TYPE_LORA, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM) != ERR_NONE ||
+           radio->LoRaBegin(spreadingFactor, bandwidth, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false) != ERR_NONE ||
+           radio->ReceiveMode(SX126X_RX_NO_TIMEOUT_CONT) != ERR_NONE ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Run(uint64_t us)
+  {
+    for ( uint64_t t = 0; t < us; t += TEST_STEP_US )
+    {
+      simA.Run(TEST_STEP_US);
+      simB.Run(TEST_STEP_US);
+      Deliver();
+      a.Service();
+      b.Service();
+    }
+  }
+};
+
+
+// runs a single radio and its Service() until done() or for at most us
+static bool RunUntil(SX126xSim& sim, SX126x& radio, uint64_t us, std::function<bool(void)> done)
+{
+  for ( uint64_t t = 0; t < us; t += 1000 )
+  {
+    if ( done() ) {
+      return true;
+    }
+    sim.Run(1000);
+    radio.Service();
+  }
+  return done();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Duty cycle budget: a 1 % band with a 1 s burst allowance lets three frames of 329 ms go right away. The fourth one
+//  waits in the queue for the time GetTxDelay() predicted, and SendAsync() is refused meanwhile.
+//----------------------------------------------------------------------------------------------------------------------------
+static uint8_t txDoneCount;
+static uint64_t txDoneAt[8];
+static SX126xSim* txDoneSim;
+
+static void CountTxDone(uint8_t status, uint8_t queueId)
+{
+  if ( status == ERR_NONE && txDoneCount < 8 ) {
+    txDoneAt[txDoneCount++] = txDoneSim->Now();
+  }
+}
+
+static void CheckDutyCycle(void)
+{
+  SX126xSim sim;
+  SX126x radio(&sim);
+  radio.ModuleConfig(SX126X_PACKET_TYPE_LORA, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM, SX126X_DEFAULT_MODE_STBY_RC);
+  radio.LoRaBegin(9, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  radio.SetDutyCycleBand(0, 868000000, 868600000, 100, 1000);
+  txDoneCount = 0;
+  txDoneSim = &sim;
+  radio.setTxDoneHook(CountTxDone);
+
+  static uint8_t frames[4][50];
+  bool queued = true;
+  for ( uint8_t i = 0; i < 4; i++ ) {
+    queued = queued && radio.SendQueued(frames[i], sizeof(frames[i])) == ERR_NONE;
+  }
+  RunUntil(sim, radio, 2000000, [](){ return txDoneCount >= 3; });
+  uint32_t delayMs = radio.GetTxDelay(50);
+  uint64_t waitFrom = sim.Now();
+  Check("duty cycle: three frames fit the burst allowance, the fourth is held back",
+        queued && txDoneCount == 3 && delayMs > 0 && sim.counters.txFrames == 3);
+  Check("duty cycle: SendAsync() is refused while the budget is spent", radio.SendAsync(frames[0], 50) == ERR_DUTY_CYCLE);
+
+  RunUntil(sim, radio, 60000000, [](){ return txDoneCount >= 4; });
+  uint64_t waitedMs = (txDoneAt[3] - waitFrom) / 1000;
+  uint32_t toaMs = radio.GetTimeOnAir(50) / 1000;
+  Check("duty cycle: the held frame goes out when GetTxDelay() said",
+        txDoneCount == 4 && waitedMs + 50 >= delayMs + toaMs && waitedMs <= delayMs + toaMs + 50);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  RX duty cycle: with a 64 symbol preamble every frame is caught by one of the sniff windows. Transmitters with the
+//  usual 8 symbol preamble fall between the windows most of the time, which shows the receiver really sleeps, and a
+//  preamble too short to sniff for is refused.
+//----------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::vector<uint8_t>> received;
+
+static void Collect(uint8_t status, SX126xRxPacket* packet)
+{
+  if ( status == ERR_NONE && packet != NULL ) {
+    received.push_back(std::vector<uint8_t>(packet->data, packet->data + packet->len));
+  }
+}
+
+static uint16_t InjectSpread(SX126xSim& sim, SX126x& radio, uint16_t count)
+{
+  static uint8_t frame[10] = { 1, 2, 3 };
+  uint16_t injected = 0;
+  for ( uint16_t i = 0; i < count; i++ )
+  {
+    RunUntil(sim, radio, 1000 + (i * 977) % 50000, [](){ return false; });
+    injected += sim.InjectPacket(frame, sizeof(frame)) ? 1 : 0;
+    RunUntil(sim, radio, 600000, [](){ return false; });
+  }
+  return injected;
+}
+
+static void CheckRxDutyCycle(void)
+{
+  SX126xSim sim;
+  SX126x radio(&sim);
+  radio.ModuleConfig(SX126X_PACKET_TYPE_LORA, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM);
+  radio.LoRaBegin(9, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 64, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  radio.setRxDoneHook(Collect);
+  received.clear();
+
+  uint8_t rv = radio.ReceiveDutyCycle();
+  uint16_t injected = InjectSpread(sim, radio, 50);
+  Check("sniff: every frame with a 64 symbol preamble is received",
+        rv == ERR_NONE && injected == 50 && received.size() == 50 && sim.counters.rxMissed == 0);
+
+  radio.LoRaBegin(9, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  rv = radio.ReceiveDutyCycle(64);
+  received.clear();
+  sim.ResetCounters();
+  injected = InjectSpread(sim, radio, 50);
+  Check("sniff: frames with an 8 symbol preamble fall between the windows",
+        rv == ERR_NONE && sim.counters.rxMissed > 0 && received.size() == injected && injected < 50);
+  Check("sniff: a preamble too short to sniff for is refused", radio.ReceiveDutyCycle(10) == ERR_UNSUPPORTED_MODE);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Listen before talk and CAD receive: Send() goes out after one CAD on a free channel, waits out a busy channel with
+//  backoffs, and gives up with ERR_CHANNEL_BUSY when all attempts find it busy. ReceiveCad() starts RX on every frame
+//  its CADs detect.
+//----------------------------------------------------------------------------------------------------------------------------
+static void CheckCad(void)
+{
+  SX126xSim sim;
+  SX126x radio(&sim);
+  radio.ModuleConfig(SX126X_PACKET_TYPE_LORA, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM, SX126X_DEFAULT_MODE_STBY_RC);
+  radio.LoRaBegin(9, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 64, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  radio.SetListenBeforeTalk(4);
+  uint8_t frame[10] = { 1, 2, 3 };
+
+  sim.ResetCounters();
+  uint8_t rv = radio.Send(frame, sizeof(frame));
+  Check("LBT: a free channel is sent on after one CAD",
+        rv == ERR_NONE && sim.counters.cads == 1 && sim.counters.txFrames == 1);
+
+  sim.ResetCounters();
+  sim.SetChannelBusy(500000);
+  rv = radio.Send(frame, sizeof(frame));
+  Check("LBT: a channel busy for 500 ms is sent on after a backoff",
+        rv == ERR_NONE && sim.counters.cadDetections > 0 && sim.counters.cads > sim.counters.cadDetections &&
+        sim.counters.txFrames == 1);
+
+  sim.ResetCounters();
+  sim.SetChannelBusy(100000000);
+  rv = radio.Send(frame, sizeof(frame));
+  Check("LBT: a channel that stays busy gives ERR_CHANNEL_BUSY and nothing is sent",
+        rv == ERR_CHANNEL_BUSY && sim.counters.cads == 4 && sim.counters.txFrames == 0);
+  sim.Run(100000000);
+
+  radio.SetListenBeforeTalk(0);
+  radio.setRxDoneHook(Collect);
+  received.clear();
+  rv = radio.ReceiveCad();
+  uint16_t injected = InjectSpread(sim, radio, 20);
+  Check("CAD receive: every frame a CAD detects is received",
+        rv == ERR_NONE && injected == 20 && received.size() == 20 && sim.counters.cadDetections >= 20);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  GFSK: GfskBegin() takes a valid configuration, refuses out of range parameters, and a frame sent by one radio arrives
+//  unchanged at the other.
+//----------------------------------------------------------------------------------------------------------------------------
+static void CheckGfsk(void)
+{
+  Link link;
+  static const uint8_t sync[4] = { 0xC1, 0x94, 0xC1, 0x94 };
+  uint8_t rv = ERR_NONE;
+  for ( SX126x* radio : { &link.a, &link.b } )
+  {
+    rv |= radio->ModuleConfig(SX126X_PACKET_TYPE_GFSK, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM);
+    rv |= radio->GfskBegin(250000, 125000, SX126X_GFSK_RX_BW_467_0, SX126X_GFSK_FILTER_GAUSS_0_5, 32, sync, 4);
+    rv |= radio->ReceiveMode(SX126X_RX_NO_TIMEOUT_CONT);
+  }
+  Check("GFSK: GfskBegin() takes a valid configuration", rv == ERR_NONE && link.simB.Mode() == SX126X_STATUS_MODE_RX);
+  uint8_t bitRate = link.a.GfskBegin(100, 5000, SX126X_GFSK_RX_BW_467_0, SX126X_GFSK_FILTER_GAUSS_0_5, 32, sync, 4);
+  uint8_t preamble = link.a.GfskBegin(250000, 125000, SX126X_GFSK_RX_BW_467_0, SX126X_GFSK_FILTER_GAUSS_0_5, 8, sync, 4);
+  uint8_t crc = link.a.GfskBegin(250000, 125000, SX126X_GFSK_RX_BW_467_0, SX126X_GFSK_FILTER_GAUSS_0_5, 32, sync, 4, 0x33);
+  Check("GFSK: GfskBegin() refuses a bit rate, preamble length and CRC type out of range",
+        bitRate == ERR_INVALID_BIT_RATE && preamble == ERR_INVALID_PREAMBLE_LENGTH && crc == ERR_INVALID_CRC_TYPE);
+
+  link.b.setRxDoneHook(Collect);
+  received.clear();
+  uint8_t frame[200];
+  for ( uint16_t i = 0; i < sizeof(frame); i++ ) {
+    frame[i] = i * 7 + 3;
+  }
+  rv = link.a.SendAsync(frame, sizeof(frame));
+  link.Run(50000);
+  Check("GFSK: a frame arrives unchanged",
+        rv == ERR_NONE && received.size() == 1 && received[0] == std::vector<uint8_t>(frame, frame + sizeof(frame)));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Stream: a transfer of several fragments arrives intact. When one fragment is lost the receiver reports the transfer
+//  with ERR_STREAM_INCOMPLETE once the last fragment is in, with the bytes it got.
+//----------------------------------------------------------------------------------------------------------------------------
+static uint8_t streamStatus;
+static uint32_t streamReceived;
+static uint32_t streamTotal;
+
+static void StreamProgress(uint8_t status, uint32_t received, uint32_t total)
+{
+  streamStatus = status;
+  streamReceived = received;
+  streamTotal = total;
+}
+
+static void CheckStream(void)
+{
+  Link link;
+  link.LoRa(7, SX126X_LORA_BW_500_0);
+  link.b.setStreamRxHook(StreamProgress);
+  static uint8_t data[2000];
+  static uint8_t buffer[2048];
+  for ( uint16_t i = 0; i < sizeof(data); i++ ) {
+    data[i] = i * 7 + 3;
+  }
+
+  streamStatus = 0xFF;
+  link.b.StreamReceive(buffer, sizeof(buffer));
+  uint8_t rv = link.a.StreamSend(data, sizeof(data));
+  link.Run(3000000);
+  Check("stream: 2000 bytes in 9 fragments arrive intact",
+        rv == ERR_NONE && streamStatus == ERR_NONE && streamTotal == sizeof(data) && memcmp(data, buffer, sizeof(data)) == 0);
+
+  drop = [](const uint8_t* frame, uint8_t len) { return frame[0] == SX126X_STREAM_MARKER && frame[2] == 0 && frame[3] == 2; };
+  streamStatus = 0xFF;
+  rv = link.a.StreamSend(data, sizeof(data));
+  link.Run(3000000);
+  Check("stream: a lost fragment gives ERR_STREAM_INCOMPLETE",
+        rv == ERR_NONE && streamStatus == ERR_STREAM_INCOMPLETE &&
+        streamReceived == sizeof(data) - SX126X_STREAM_FRAGMENT_SIZE);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Reliable link: when the acknowledgement of a burst is lost the sender repeats one frame to ask for it again, every
+//  frame is acknowledged once and delivered once. With protocol framing an application frame that starts with the data
+//  marker is escaped on air and still reaches the application; without it frames go on air unchanged.
+//----------------------------------------------------------------------------------------------------------------------------
+static uint8_t ackedCount[4];
+static uint16_t dataFrames;
+static std::vector<uint8_t> lastOnAir;
+
+static void CountAcked(uint8_t status, uint8_t seq)
+{
+  if ( status == ERR_NONE && seq < 4 ) {
+    ackedCount[seq]++;
+  }
+}
+
+static void CheckReliable(void)
+{
+  Link link;
+  link.LoRa(7, SX126X_LORA_BW_125_0);
+  link.a.setReliableTxHook(CountAcked);
+  link.b.setRxDoneHook(Collect);
+  link.b.ReliableReceive(true);
+  received.clear();
+  memset(ackedCount, 0, sizeof(ackedCount));
+  dataFrames = 0;
+
+  static bool ackDropped;
+  ackDropped = false;
+  drop = [](const uint8_t* frame, uint8_t len)
+  {
+    bool first = frame[0] == SX126X_ARQ_ACK_MARKER && !ackDropped;
+    ackDropped = ackDropped || first;
+    return first;
+  };
+  onAir = [](Frame& frame)
+  {
+    dataFrames += (frame.data[0] == SX126X_ARQ_DATA_MARKER) ? 1 : 0;
+    lastOnAir = frame.data;
+  };
+
+  static uint8_t frames[4][40];
+  uint8_t rv = ERR_NONE;
+  for ( uint8_t i = 0; i < 4; i++ )
+  {
+    frames[i][0] = i;
+    rv |= link.a.ReliableSend(frames[i], sizeof(frames[i]));
+  }
+  link.Run(3000000);
+  bool once = received.size() == 4;
+  for ( uint8_t i = 0; i < 4; i++ ) {
+    once = once && ackedCount[i] == 1 && received[i] == std::vector<uint8_t>(frames[i], frames[i] + sizeof(frames[i]));
+  }
+  Check("ARQ: a lost acknowledgement costs one retransmission", rv == ERR_NONE && ackDropped && dataFrames == 5);
+  Check("ARQ: every frame is acknowledged once and delivered once, in order", once && link.a.ReliablePending() == 0);
+
+  uint8_t reserved[8] = { SX126X_ARQ_DATA_MARKER, 1, 2, 3, 4, 5, 6, 7 };
+  link.a.SetProtocolFraming(true);
+  link.b.SetProtocolFraming(true);
+  received.clear();
+  rv = link.a.SendAsync(reserved, sizeof(reserved));
+  link.Run(100000);
+  Check("framing on: an application frame starting with a reserved byte is escaped and arrives unchanged",
+        rv == ERR_NONE && lastOnAir.size() == sizeof(reserved) + 1 && lastOnAir[0] == SX126X_ESCAPE_MARKER &&
+        received.size() == 1 && received[0] == std::vector<uint8_t>(reserved, reserved + sizeof(reserved)));
+
+  uint8_t escape[4] = { SX126X_ESCAPE_MARKER, 1, 2, 3 };
+  link.a.SetProtocolFraming(false);
+  link.b.SetProtocolFraming(false);
+  received.clear();
+  rv = link.a.SendAsync(escape, sizeof(escape));
+  link.Run(100000);
+  Check("framing off: frames go on air and arrive unchanged",
+        rv == ERR_NONE && lastOnAir == std::vector<uint8_t>(escape, escape + sizeof(escape)) &&
+        received.size() == 1 && received[0] == lastOnAir);
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Link adaptation: both ends start on SF12 at full power. A good link moves them up the ladder and lowers the TX power,
+//  a fade that leaves too little margin moves them back down, and both ends always agree on the rate. A frame is only
+//  heard when the receiver is on the sender's rate and its SNR is above the demodulation floor of that rate.
+//----------------------------------------------------------------------------------------------------------------------------
+static const SX126xLinkRate ladder[] = {
+  { 7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 },  { 8, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 },
+  { 9, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 },  { 10, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 },
+  { 11, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 }, { 12, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5 } };
+
+static int8_t pathSnr;                        // SNR of a frame sent at TEST_TX_POWER_DBM
+
+// the two ends report their margin to each other every 2 s
+static void RunLink(Link& link, uint16_t seconds)
+{
+  for ( uint16_t s = 0; s < seconds; s++ )
+  {
+    link.Run(1000000);
+    if ( s & 1 ) {
+      link.b.LinkReport();
+    }
+    else {
+      link.a.LinkReport();
+    }
+  }
+}
+
+static void CheckLinkAdaptation(void)
+{
+  Link link;
+  link.LoRa(12, SX126X_LORA_BW_125_0);
+  uint8_t rv = link.a.LinkAdaptBegin(ladder, 6, 5, 0, TEST_TX_POWER_DBM, 6);
+  rv |= link.b.LinkAdaptBegin(ladder, 6, 5, 0, TEST_TX_POWER_DBM, 6);
+
+  onAir = [&link](Frame& frame)
+  {
+    SX126x& from = (frame.to == &link.simB) ? link.a : link.b;
+    int16_t snr = pathSnr + from.GetLinkTxPower() - TEST_TX_POWER_DBM;
+    frame.rate = from.GetLinkRate();
+    frame.snr = (snr > 10) ? 10 : snr;
+  };
+  audible = [&link](const Frame& frame)
+  {
+    SX126x& to = (frame.to == &link.simB) ? link.b : link.a;
+    return to.GetLinkRate() == frame.rate && frame.snr * 4 >= SX126xLoRaSnrFloor(ladder[frame.rate].spreadingFactor);
+  };
+
+  pathSnr = 0;
+  RunLink(link, 20);
+  uint8_t upRate = link.a.GetLinkRate();
+  int8_t upPower = link.a.GetLinkTxPower();
+  Check("link: a good link moves up the ladder and lowers the TX power",
+        rv == ERR_NONE && upRate < 5 && upPower < TEST_TX_POWER_DBM && link.b.GetLinkRate() == upRate);
+
+  pathSnr = -6;
+  RunLink(link, 30);
+  Check("link: a fade moves both ends down the ladder and raises the TX power",
+        link.a.GetLinkRate() > upRate && link.a.GetLinkTxPower() > upPower && link.b.GetLinkRate() == link.a.GetLinkRate());
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Frequency hopping: the sender moves on after every frame and the receiver after every frame it received, so frames
+//  go on air on the channels of the table in order and all of them arrive. A hop hook replaces the order, and HopTo()
+//  retunes to a channel of the table.
+//----------------------------------------------------------------------------------------------------------------------------
+static constexpr SX126xHopChannel hopTable[] = { 868100000, 868300000, 915000000, 868500000 };
+static std::vector<uint32_t> hopFrequencies;
+
+static uint8_t HopBackwards(uint8_t channel)
+{
+  return (channel + 3) % 4;
+}
+
+// sends count frames one at a time, the frequencies they went on air on end up in hopFrequencies
+static bool SendHopping(Link& link, uint8_t count)
+{
+  hopFrequencies.clear();
+  received.clear();
+  for ( uint8_t i = 0; i < count; i++ )
+  {
+    uint8_t frame[20] = { i };
+    if ( link.a.SendAsync(frame, sizeof(frame)) != ERR_NONE ) {
+      return false;
+    }
+    link.Run(100000);
+  }
+  return received.size() == count;
+}
+
+static void CheckHop(void)
+{
+  Link link;
+  link.LoRa(7, SX126X_LORA_BW_125_0);
+  link.b.setRxDoneHook(Collect);
+  uint8_t rv = link.a.HopBegin(hopTable, 4, 0, SX126X_HOP_AFTER_TX);
+  rv |= link.b.HopBegin(hopTable, 4, 0, SX126X_HOP_AFTER_RX);
+  onAir = [](Frame& frame) { hopFrequencies.push_back(frame.frequency); };
+
+  bool all = SendHopping(link, 8);
+  bool inOrder = hopFrequencies.size() == 8;
+  for ( uint8_t i = 0; inOrder && i < 8; i++ ) {
+    inOrder = hopFrequencies[i] == SX126xFrequencyWord(hopTable[i % 4].frequencyInHz) && received[i][0] == i;
+  }
+  Check("hop: frames go on air on the channels of the table in order, across image calibration bands",
+        rv == ERR_NONE && inOrder);
+  Check("hop: the receiver follows and gets every frame", all);
+
+  link.a.setHopHook(HopBackwards);
+  link.b.setHopHook(HopBackwards);
+  all = SendHopping(link, 4);
+  inOrder = hopFrequencies.size() == 4;
+  for ( uint8_t i = 0; inOrder && i < 4; i++ ) {
+    inOrder = hopFrequencies[i] == SX126xFrequencyWord(hopTable[(4 - i) % 4].frequencyInHz);
+  }
+  Check("hop: the hop hook sets the order", all && inOrder);
+
+  Check("hop: HopTo() retunes within the table and refuses a channel outside it",
+        link.a.HopTo(4) == ERR_UNKNOWN && link.a.HopTo(2) == ERR_NONE && link.a.GetHopChannel() == 2 &&
+        link.simA.Frequency() == SX126xFrequencyWord(hopTable[2].frequencyInHz));
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------------
+//  Dual radio: in SX126X_DUAL_SHARED mode a frame the radio picked first has no room for is queued on the other one,
+//  and only when neither has room the frame is refused. SX126X_DUAL_DEDICATED sends on radio 1 only. Received packets
+//  of the two radios are handed out in turn.
+//----------------------------------------------------------------------------------------------------------------------------
+static void CheckDual(void)
+{
+  SX126xSim sim0;
+  SX126xSim sim1;
+  SX126x radio0(&sim0);
+  SX126x radio1(&sim1);
+  radio0.ModuleConfig(SX126X_PACKET_TYPE_LORA, TEST_FREQUENCY_HZ, TEST_TX_POWER_DBM);
+  radio1.ModuleConfig(SX126X_PACKET_TYPE_LORA, 868500000, TEST_TX_POWER_DBM);
+  for ( SX126x* radio : { &radio0, &radio1 } ) {
+    radio->LoRaBegin(7, SX126X_LORA_BW_125_0, SX126X_LORA_CR_4_5, 8, SX126X_LORA_HEADER_EXPLICIT, true, false);
+  }
+  SX126xDual dual(&radio0, &radio1, SX126X_DUAL_SHARED);
+
+  // radio 0: a full queue held back by its duty cycle band, radio 1: one frame on air and room for one more in the queue
+  static uint8_t frame[20];
+  radio0.SetDutyCycleBand(0, 868000000, 868200000, 1000, 1);
+  uint8_t rv = ERR_NONE;
+  for ( uint8_t i = 0; i < SX126X_TX_QUEUE_DEPTH; i++ ) {
+    rv |= radio0.SendQueued(frame, sizeof(frame));
+  }
+  rv |= radio1.SendAsync(frame, sizeof(frame));
+  for ( uint8_t i = 0; i < SX126X_TX_QUEUE_DEPTH - 1; i++ ) {
+    rv |= radio1.SendQueued(frame, sizeof(frame));
+  }
+
+  uint8_t index = SX126X_DUAL_NONE;
+  uint8_t sent = dual.Send(frame, sizeof(frame), 0, &index);
+  Check("dual shared: a frame the first radio has no room for goes to the other one",
+        rv == ERR_NONE && radio0.GetTxBacklog() == SX126X_TX_QUEUE_DEPTH && sent == ERR_NONE && index == 1);
+  Check("dual shared: a frame neither radio has room for is refused", dual.Send(frame, sizeof(frame)) == ERR_DEVICE_BUSY);
+
+  radio0.SetDutyCycleBand(0, 868000000, 868200000, 0, 0);
+  for ( uint16_t i = 0; i < 10000; i++ )
+  {
+    sim0.Run(100);
+    sim1.Run(100);
+    dual.Service();
+  }
+  dual.SetMode(SX126X_DUAL_DEDICATED);
+  bool dedicated = radio0.GetTxBacklog() == 0 && radio1.GetTxBacklog() == 0;
+  for ( uint8_t i = 0; i < 3; i++ )
+  {
+    index = SX126X_DUAL_NONE;
+    dedicated = dedicated && dual.Send(frame, sizeof(frame), 0, &index) == ERR_NONE && index == 1;
+  }
+  Check("dual dedicated: every frame goes to radio 1", dedicated);
+
+  for ( uint16_t i = 0; i < 10000; i++ )
+  {
+    sim0.Run(100);
+    sim1.Run(100);
+    dual.Service();
+  }
+  uint8_t packet[3] = { 1, 2, 3 };
+  for ( uint8_t i = 0; i < 2; i++ )
+  {
+    sim0.InjectPacket(packet, 3);
+    sim1.InjectPacket(packet, 2);
+    sim0.Run(100000);
+    sim1.Run(100000);
+  }
+  // radio 0 got frames of 3 bytes, radio 1 frames of 2 bytes
+  std::vector<uint8_t> order;
+  SX126xRxPacket* rx;
+  while ( order.size() < 8 && (rx = dual.BorrowRxPacket(&index)) != NULL )
+  {
+    order.push_back((rx->len == 3 - index) ? index : SX126X_DUAL_NONE);
+    dual.ReleaseRxPacket();
+  }
+  Check("dual: received packets of the two radios are handed out in turn", order == std::vector<uint8_t>({ 0, 1, 0, 1 }));
+}
+
+
+int main(void)
+{
+  CheckDutyCycle();
+  CheckRxDutyCycle();
+  CheckCad();
+  CheckGfsk();
+  CheckStream();
+  CheckReliable();
+  CheckLinkAdaptation();
+  CheckHop();
+  CheckDual();
+
+  return failures;
+}